@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include "batch.h"
+
+static int add_file(FILE_LIST *list, char *path)
+{
+	if(list->n == list->cap){
+		int cap = list->cap > 0 ? list->cap*2 : 256;
+		char **p = (char **)realloc(list->path, cap*sizeof(char *));
+		if(p == NULL){
+			return -1;
+		}
+		list->path = p;
+		list->cap = cap;
+	}
+	list->path[list->n] = strdup(path);
+	if(list->path[list->n] == NULL){
+		return -1;
+	}
+	list->n++;
+	return 0;
+}
+
+static char *base_name(char *path)
+{
+	char *p = strrchr(path, '/');
+	return p == NULL ? path : p+1;
+}
+
+/* Same as "find dir/ -name pattern": recurse, do not follow linked
+ * directories. A directory that can not be opened is reported and
+ * returns 1; below the top one it is skipped, as find warns and goes on.
+ */
+static int walk_dir(char *dir, char *pattern, FILE_LIST *list)
+{
+	DIR *dp = opendir(dir);
+	if(dp == NULL){
+		fprintf(stderr, "CAN NOT OPEN DIRECTORY %s\n", dir);
+		return 1;
+	}
+
+	struct dirent *ent;
+	struct stat st;
+	char path[4096];
+	int ret = 0;
+
+	while(ret == 0 && (ent = readdir(dp)) != NULL){
+		if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0){
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+		if(lstat(path, &st) != 0){
+			continue;
+		}
+		if(S_ISDIR(st.st_mode)){
+			ret = walk_dir(path, pattern, list) < 0 ? -1 : 0;
+		}
+		else if(fnmatch(pattern, ent->d_name, 0) == 0){
+			ret = add_file(list, path);
+		}
+	}
+
+	closedir(dp);
+	return ret;
+}
+
+static int cmp_path(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// src is either a directory searched recursively, or a text file with one path per line
+int collect_files(char *src, char *pattern, FILE_LIST *list)
+{
+	struct stat st;
+
+	list->path = NULL;
+	list->n = 0;
+	list->cap = 0;
+
+	if(stat(src, &st) != 0){
+		fprintf(stderr, "CAN NOT FIND %s\n", src);
+		return -1;
+	}
+
+	if(S_ISDIR(st.st_mode)){
+		if(0 != walk_dir(src, pattern, list)){
+			return -1;
+		}
+	}
+	else{
+		FILE *fp = fopen(src, "r");
+		if(fp == NULL){
+			return -1;
+		}
+		char line[4096];
+		while(fgets(line, sizeof(line), fp) != NULL){
+			line[strcspn(line, "\r\n")] = '\0';
+			if(line[0] == '\0' || line[0] == '#'){
+				continue;
+			}
+			if(fnmatch(pattern, base_name(line), 0) == 0 && 0 != add_file(list, line)){
+				fclose(fp);
+				return -1;
+			}
+		}
+		fclose(fp);
+	}
+
+	qsort(list->path, list->n, sizeof(char *), cmp_path);
+	return 0;
+}
+
+void free_file_list(FILE_LIST *list)
+{
+	int i;
+	for(i=0; i<list->n; i++){
+		free(list->path[i]);
+	}
+	free(list->path);
+	list->path = NULL;
+	list->n = 0;
+	list->cap = 0;
+}
+
+/* The file next to path matching pattern, e.g. the SCL image of an
+ * albedo image. A directory part of the pattern, such as "../R20m/", is
+ * taken relative to the directory of path and only the name part is
+ * matched; the first match in name order goes to found.
+ */
+int find_sibling(char *path, char *pattern, char *found, size_t n)
+{
+	char dir[4096];
+	char *name = strrchr(pattern, '/');
+	char *slash = strrchr(path, '/');
+	struct dirent *ent;
+	DIR *dp;
+	int have = 0;
+
+	if(slash == NULL){
+		snprintf(dir, sizeof(dir), ".");
+	}
+	else{
+		snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+	}
+	if(name != NULL){
+		size_t len = strlen(dir);
+		snprintf(dir + len, sizeof(dir) - len, "/%.*s", (int)(name - pattern), pattern);
+		name++;
+	}
+	else{
+		name = pattern;
+	}
+
+	dp = opendir(dir);
+	if(dp == NULL){
+		return -1;
+	}
+	while((ent = readdir(dp)) != NULL){
+		if(fnmatch(name, ent->d_name, 0) != 0){
+			continue;
+		}
+		if(!have || strcmp(ent->d_name, found + strlen(dir) + 1) < 0){
+			snprintf(found, n, "%s/%s", dir, ent->d_name);
+			have = 1;
+		}
+	}
+	closedir(dp);
+	return have ? 0 : -1;
+}
+
+/* Acquisition date from the SAFE folder name the granule resides in.
+ * Sentinel-2 granule file names only carry the product creation date.
+ *   old scene-based SAFE: S2A_USER_PRD_MSIL2A_..._VYYYYMMDDTHHMMSS_....SAFE
+ *   new tile-based SAFE:  ..._MSIL2A_YYYYMMDDTHHMMSS_...
+ */
+int parse_acq_date(char *path, int *year, int *doy)
+{
+	static const int cum[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+	char *p = strstr(path, "S2A_USER_PRD_MSIL2A_");
+	int i, y, m, d;
+
+	if(p != NULL && strstr(p, ".SAFE") != NULL){
+		p = strchr(p, 'V');
+		if(p == NULL){
+			return -1;
+		}
+		p++;
+	}
+	else{
+		p = strstr(path, "MSIL2A_");
+		if(p == NULL){
+			return -1;
+		}
+		p += 7;
+	}
+
+	for(i=0; i<8; i++){
+		if(!isdigit((unsigned char)p[i])){
+			return -1;
+		}
+	}
+	if(3 != sscanf(p, "%4d%2d%2d", &y, &m, &d) || m < 1 || m > 12 || d < 1 || d > 31){
+		return -1;
+	}
+
+	*year = y;
+	*doy = cum[m-1] + d;
+	if(m > 2 && ((y%4 == 0 && y%100 != 0) || y%400 == 0)){
+		(*doy)++;
+	}
+	return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef __INC_BATCH_H
+#define __INC_BATCH_H
+
+#include <stddef.h>
+
+typedef struct{
+	char **path;
+	int n;
+	int cap;
+}FILE_LIST;
+
+int collect_files(char *src, char *pattern, FILE_LIST *list);
+void free_file_list(FILE_LIST *list);
+int find_sibling(char *path, char *pattern, char *found, size_t n);
+int parse_acq_date(char *path, int *year, int *doy);
+
+#endif
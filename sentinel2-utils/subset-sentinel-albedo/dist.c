@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "envi.h"
+#include "dist.h"
+
+static const double qprob[DIST_NQ] = {0.05, 0.25, 0.5, 0.75, 0.95};
+
+static double sk_lgamma;	// log(gamma)
+static int sk_imin;		// bucket index of DIST_SK_MIN
+static int sk_nbin;
+
+static void sk_setup(void)
+{
+	if(sk_nbin > 0){
+		return;
+	}
+	sk_lgamma = log((1.0 + DIST_SK_ALPHA) / (1.0 - DIST_SK_ALPHA));
+	sk_imin = (int)ceil(log(DIST_SK_MIN) / sk_lgamma);
+	sk_nbin = (int)ceil(log(DIST_SK_MAX) / sk_lgamma) - sk_imin + 1;
+}
+
+// bucket of magnitude a >= DIST_SK_MIN
+static int sk_bin(double a)
+{
+	int i = (int)ceil(log(a) / sk_lgamma) - sk_imin;
+	return i < 0 ? 0 : (i >= sk_nbin ? sk_nbin - 1 : i);
+}
+
+// value within alpha of every magnitude of bucket i
+static double sk_value(int i)
+{
+	return 2.0 * exp((i + sk_imin) * sk_lgamma) / (1.0 + exp(sk_lgamma));
+}
+
+static int hist_bin(const DIST *d, double v)
+{
+	double x = (v - d->lo) / (d->hi - d->lo) * d->nhist;
+	return x < 0 ? 0 : (x >= d->nhist ? d->nhist - 1 : (int)x);
+}
+
+int dist_init(DIST *d, const DIST_SPEC *spec)
+{
+	memset(d, 0, sizeof(DIST));
+	d->nhist = spec->nhist;
+	d->lo = spec->lo;
+	d->hi = spec->hi;
+	switch(spec->dtype){
+	case 1:
+		d->exact = 1;
+		d->nval = 256;
+		break;
+	case 2:
+		d->exact = 1;
+		d->base = -32768;
+		d->nval = 65536;
+		break;
+	case 12:
+		d->exact = 1;
+		d->nval = 65536;
+		break;
+	}
+	if(d->exact){
+		d->count = (unsigned int *)calloc(d->nval, sizeof(unsigned int));
+		return d->count == NULL ? -1 : 0;
+	}
+	sk_setup();
+	d->pos = (long long *)calloc(2*sk_nbin, sizeof(long long));
+	d->neg = d->pos + sk_nbin;
+	d->hist = (long long *)calloc(d->nhist > 0 ? d->nhist : 1, sizeof(long long));
+	if(d->pos == NULL || d->hist == NULL){
+		dist_free(d);
+		return -1;
+	}
+	return 0;
+}
+
+void dist_free(DIST *d)
+{
+	free(d->count);
+	free(d->pos);
+	free(d->hist);
+	d->count = NULL;
+	d->pos = NULL;
+	d->neg = NULL;
+	d->hist = NULL;
+}
+
+void dist_merge(DIST *a, const DIST *b)
+{
+	int i;
+
+	if(a->exact){
+		for(i=0; i<a->nval; i++){
+			a->count[i] += b->count[i];
+		}
+	}
+	else{
+		for(i=0; i<2*sk_nbin; i++){
+			a->pos[i] += b->pos[i];
+		}
+		for(i=0; i<a->nhist; i++){
+			a->hist[i] += b->hist[i];
+		}
+		a->zero += b->zero;
+	}
+	a->n += b->n;
+}
+
+/* Typed adders. 8- and 16-bit values index their count; others are
+ * binned by magnitude and sign. nodata and NaN are left out.
+ */
+#define DIST_EXACT(T, name) \
+static void add_##name(const T *p, long npix, long step, const NODATA *nd, DIST *d) \
+{ \
+	int use = nd->set; \
+	T ndv = use ? (T)nd->value : 0; \
+	unsigned int *c = d->count - d->base; \
+	long i, n = 0; \
+	for(i=0; i<npix; i++){ \
+		T v = p[i*step]; \
+		if(!(use && v == ndv)){ \
+			c[v]++; \
+			n++; \
+		} \
+	} \
+	d->n += n; \
+}
+
+#define DIST_SKETCH(T, name) \
+static void add_##name(const T *p, long npix, long step, const NODATA *nd, DIST *d) \
+{ \
+	int use = nd->set; \
+	T ndv = use ? (T)nd->value : 0; \
+	long i; \
+	for(i=0; i<npix; i++){ \
+		T v = p[i*step]; \
+		double x = (double)v; \
+		if(v != v || (use && v == ndv)){ \
+			continue; \
+		} \
+		if(x >= DIST_SK_MIN){ \
+			d->pos[sk_bin(x)]++; \
+		} \
+		else if(x <= -DIST_SK_MIN){ \
+			d->neg[sk_bin(-x)]++; \
+		} \
+		else{ \
+			d->zero++; \
+		} \
+		if(d->nhist > 0){ \
+			d->hist[hist_bin(d, x)]++; \
+		} \
+		d->n++; \
+	} \
+}
+
+#define DIST_KERNELS(T, name) \
+static void dist_bip_##name(const void *p, long npix, int nband, long bstride, const NODATA *nd, DIST *d) \
+{ \
+	int b; \
+	for(b=0; b<nband; b++){ \
+		add_##name((const T *)p + b, npix, nband, nd, &d[b]); \
+	} \
+} \
+static void dist_planar_##name(const void *p, long npix, int nband, long bstride, const NODATA *nd, DIST *d) \
+{ \
+	int b; \
+	for(b=0; b<nband; b++){ \
+		add_##name((const T *)p + b*bstride, npix, 1, nd, &d[b]); \
+	} \
+}
+
+DIST_EXACT(unsigned char, uint8)
+DIST_EXACT(short, int16)
+DIST_EXACT(unsigned short, uint16)
+DIST_SKETCH(int, int32)
+DIST_SKETCH(unsigned int, uint32)
+DIST_SKETCH(long long, int64)
+DIST_SKETCH(unsigned long long, uint64)
+DIST_SKETCH(float, float32)
+DIST_SKETCH(double, float64)
+
+DIST_KERNELS(unsigned char, uint8)
+DIST_KERNELS(short, int16)
+DIST_KERNELS(unsigned short, uint16)
+DIST_KERNELS(int, int32)
+DIST_KERNELS(unsigned int, uint32)
+DIST_KERNELS(long long, int64)
+DIST_KERNELS(unsigned long long, uint64)
+DIST_KERNELS(float, float32)
+DIST_KERNELS(double, float64)
+
+static struct{
+	int dtype;
+	DIST_FN bip;
+	DIST_FN planar;
+}dtypes[] = {
+	{1, dist_bip_uint8, dist_planar_uint8},
+	{2, dist_bip_int16, dist_planar_int16},
+	{3, dist_bip_int32, dist_planar_int32},
+	{4, dist_bip_float32, dist_planar_float32},
+	{5, dist_bip_float64, dist_planar_float64},
+	{12, dist_bip_uint16, dist_planar_uint16},
+	{13, dist_bip_uint32, dist_planar_uint32},
+	{14, dist_bip_int64, dist_planar_int64},
+	{15, dist_bip_uint64, dist_planar_uint64},
+};
+
+// adder for a data type and interleave, NULL if the type is not supported
+DIST_FN dist_select(int dtype, int il)
+{
+	int i;
+	for(i=0; i<(int)(sizeof(dtypes) / sizeof(dtypes[0])); i++){
+		if(dtypes[i].dtype == dtype){
+			return il == ENVI_BIP ? dtypes[i].bip : dtypes[i].planar;
+		}
+	}
+	return NULL;
+}
+
+// value of rank k, 0 the smallest, in one ascending walk over the counts or buckets
+static double dist_rank(const DIST *d, long long k)
+{
+	long long seen = 0;
+	int i;
+
+	if(d->exact){
+		for(i=0; i<d->nval; i++){
+			seen += d->count[i];
+			if(k < seen){
+				return i + d->base;
+			}
+		}
+		return d->nval - 1 + d->base;
+	}
+	for(i=sk_nbin-1; i>=0; i--){
+		seen += d->neg[i];
+		if(k < seen){
+			return -sk_value(i);
+		}
+	}
+	seen += d->zero;
+	if(k < seen){
+		return 0.0;
+	}
+	for(i=0; i<sk_nbin; i++){
+		seen += d->pos[i];
+		if(k < seen){
+			return sk_value(i);
+		}
+	}
+	return sk_value(sk_nbin - 1);
+}
+
+/* P5, P25, median, P75 and P95 in stored values, interpolated between
+ * the neighbouring ranks as numpy.percentile does; exact for counted
+ * data. No values give NaN.
+ */
+void dist_quantiles(const DIST *d, double *q)
+{
+	int i;
+
+	for(i=0; i<DIST_NQ; i++){
+		double h = qprob[i] * (d->n - 1);
+		long long k = (long long)floor(h);
+		if(d->n == 0){
+			q[i] = NAN;
+			continue;
+		}
+		q[i] = dist_rank(d, k);
+		if(k + 1 < d->n && h > k){
+			q[i] += (h - k) * (dist_rank(d, k + 1) - q[i]);
+		}
+	}
+}
+
+// histogram counts, from the value counts when exact
+void dist_hist(const DIST *d, long long *hist)
+{
+	int i;
+
+	if(!d->exact){
+		memcpy(hist, d->hist, d->nhist*sizeof(long long));
+		return;
+	}
+	memset(hist, 0, d->nhist*sizeof(long long));
+	for(i=0; i<d->nval; i++){
+		if(d->count[i] > 0){
+			hist[hist_bin(d, i + d->base)] += d->count[i];
+		}
+	}
+}
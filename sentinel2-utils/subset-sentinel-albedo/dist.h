@@ -0,0 +1,56 @@
+#ifndef __INC_DIST_H
+#define __INC_DIST_H
+
+#include "kernel.h"
+
+// quantiles reported: P5, P25, median, P75, P95
+#define DIST_NQ (5)
+#define DIST_MAX_HIST (256)
+
+/* Quantile sketch: buckets of values whose magnitude lies in
+ * (gamma^(i-1), gamma^i] for |x| from DIST_SK_MIN to DIST_SK_MAX, so a
+ * bucket's representative is within DIST_SK_ALPHA of any value in it.
+ * Smaller magnitudes count as zero, larger ones go to the last bucket.
+ */
+#define DIST_SK_ALPHA (0.005)
+#define DIST_SK_MIN (1e-6)
+#define DIST_SK_MAX (1e9)
+
+// histogram bins over lo..hi in stored values; out of range goes to the end bins
+typedef struct{
+	int dtype;
+	int nhist;
+	double lo;
+	double hi;
+}DIST_SPEC;
+
+/* Value distribution of one band: 8- and 16-bit data keep a count per
+ * value, exact; other types the sketch above and a histogram filled as
+ * values come. Both merge by adding counts and take bounded memory
+ * however many values they see.
+ */
+typedef struct{
+	int exact;
+	int base;		// value of count[0]
+	int nval;
+	unsigned int *count;
+	long long *pos;		// sketch, by magnitude
+	long long *neg;
+	long long zero;
+	long long n;
+	int nhist;
+	double lo;
+	double hi;
+	long long *hist;
+}DIST;
+
+typedef void (*DIST_FN)(const void *p, long npix, int nband, long bstride, const NODATA *nd, DIST *d);
+
+DIST_FN dist_select(int dtype, int il);
+int dist_init(DIST *d, const DIST_SPEC *spec);
+void dist_free(DIST *d);
+void dist_merge(DIST *a, const DIST *b);
+void dist_quantiles(const DIST *d, double *q);
+void dist_hist(const DIST *d, long long *hist);
+
+#endif
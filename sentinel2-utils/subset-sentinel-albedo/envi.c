@@ -1,7 +1,80 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <assert.h>
 #include "envi.h"
 
+// value after the "=", or the first of a {} list
+static int hdr_value(char *line, double *v)
+{
+	char *p = strchr(line, '=');
+	char *end;
+
+	if(p == NULL){
+		return -1;
+	}
+	p += strspn(p+1, " \t{") + 1;
+	*v = strtod(p, &end);
+	return end == p ? -1 : 0;
+}
+
+/* Fields of the {} list of the line, which may continue over the lines
+ * after it, split at the commas and trimmed in place. Returns how many,
+ * at most max.
+ */
+static int hdr_list(FILE *fp, char *line, int size, char **f, int max)
+{
+	char *p, *q, *e;
+	int len = strlen(line);
+	int n = 0;
+
+	while(strchr(line, '}') == NULL && len < size - 1 && fgets(line + len, size - len, fp) != NULL){
+		len += strlen(line + len);
+	}
+	p = strchr(line, '{');
+	if(p == NULL){
+		return 0;
+	}
+	p++;
+	if((q = strchr(p, '}')) != NULL){
+		*q = 0;
+	}
+	while(n < max){
+		q = strchr(p, ',');
+		if(q != NULL){
+			*q = 0;
+		}
+		p += strspn(p, " \t\r\n");
+		for(e=p+strlen(p); e>p && isspace((unsigned char)e[-1]); e--){
+			e[-1] = 0;
+		}
+		f[n++] = p;
+		if(q == NULL){
+			break;
+		}
+		p = q + 1;
+	}
+	return n;
+}
+
+// value of a "key=value" field, NULL for another key
+static char *hdr_key(char *f, const char *key)
+{
+	int n = strlen(key);
+
+	if(strncasecmp(f, key, n) != 0){
+		return NULL;
+	}
+	f += n + strspn(f + n, " \t");
+	if(*f != '='){
+		return NULL;
+	}
+	f++;
+	return f + strspn(f, " \t");
+}
+
 int read_envi_hdr(char *hdr, ENVI_HDR *envi)
 {
 	if(envi == NULL){
@@ -12,11 +85,16 @@ int read_envi_hdr(char *hdr, ENVI_HDR *envi)
 	if(fp == NULL){
 		return -1;
 	}
+	memset(envi, 0, sizeof(ENVI_HDR));
+	envi->il = -1;
+	envi->scale = 1.0;
 
-	char line[1024];
-	char stmp[20];
+	char line[4096];
+	char *f[ENVI_MAX_BAND], *end, *p;
+	double v;
+	int n, i;
 
-	while(fgets(line, 1023, fp) != NULL){
+	while(fgets(line, sizeof(line), fp) != NULL){
 		if(strncmp(line, "samples", 7) == 0){
 			assert(1 == sscanf(line, "%*s = %d", &envi->ncol));
 		}	
@@ -29,17 +107,153 @@ int read_envi_hdr(char *hdr, ENVI_HDR *envi)
 		if(strncmp(line, "data type", 9) == 0){
 			assert(1 == sscanf(line, "%*s %*s = %d", &envi->dtype));
 		}	
+		if(strncmp(line, "byte order", 10) == 0){
+			assert(1 == sscanf(line, "%*s %*s = %d", &envi->byteorder));
+		}	
+		if(strncmp(line, "header offset", 13) == 0){
+			assert(1 == sscanf(line, "%*s %*s = %lld", &envi->hoffset));
+		}	
+		if(strncmp(line, "data ignore value", 17) == 0){
+			assert(0 == hdr_value(line, &envi->ignore));
+			envi->has_ignore = 1;
+		}	
+		if(strncmp(line, "scale factor", 12) == 0 || strncmp(line, "reflectance scale factor", 24) == 0){
+			assert(0 == hdr_value(line, &v));
+			if(v != 0){
+				envi->scale = v;
+				envi->has_scale = 1;
+			}
+		}	
+		if(strncmp(line, "data gain values", 16) == 0){
+			n = hdr_list(fp, line, sizeof(line), f, ENVI_MAX_BAND);
+			for(envi->ngain=0; envi->ngain<n; envi->ngain++){
+				envi->gain[envi->ngain] = atof(f[envi->ngain]);
+			}
+		}	
+		if(strncmp(line, "data offset values", 18) == 0){
+			n = hdr_list(fp, line, sizeof(line), f, ENVI_MAX_BAND);
+			for(envi->noffset=0; envi->noffset<n; envi->noffset++){
+				envi->offset[envi->noffset] = atof(f[envi->noffset]);
+			}
+		}	
+		if(strncmp(line, "band names", 10) == 0){
+			n = hdr_list(fp, line, sizeof(line), f, ENVI_MAX_BAND);
+			for(envi->nbname=0; envi->nbname<n; envi->nbname++){
+				snprintf(envi->bname[envi->nbname], ENVI_MAX_NAME, "%s", f[envi->nbname]);
+			}
+		}	
 		if(strncmp(line, "interleave", 10) == 0){
-			assert(1 == sscanf(line, "%*s = %s", envi->interleave));
+			assert(1 == sscanf(line, "%*s = %9s", envi->interleave));
+			if(strcasecmp(envi->interleave, "bsq") == 0){
+				envi->il = ENVI_BSQ;
+			}
+			else if(strcasecmp(envi->interleave, "bil") == 0){
+				envi->il = ENVI_BIL;
+			}
+			else if(strcasecmp(envi->interleave, "bip") == 0){
+				envi->il = ENVI_BIP;
+			}
 		}	
+		/* map info = {projection, tie x, tie y, easting, northing, pixel x,
+		 * pixel y[, zone, hemisphere][, datum][, units=..][, rotation=..]},
+		 * the zone and hemisphere for UTM only
+		 */
 		if(strncmp(line, "map info", 8) == 0){
-			assert(11 == sscanf(line, "%*s %*5s{%[^,], %lf, %lf, %lf, %lf, %lf, %lf, %d, %[^,], %[^,], %*[^=]=%[^}]}",
-															envi->proj, &envi->tieX, &envi->tieY, &envi->upleftX, &envi->upleftY, 
-															&envi->pixsizeX, &envi->pixsizeY, &envi->utmzone, envi->orig, envi->datum, envi->unit));
+			n = hdr_list(fp, line, sizeof(line), f, 32);
+			if(n < 7){
+				fclose(fp);
+				return -1;
+			}
+			snprintf(envi->proj, sizeof(envi->proj), "%s", f[0]);
+			envi->tieX = atof(f[1]);
+			envi->tieY = atof(f[2]);
+			envi->upleftX = atof(f[3]);
+			envi->upleftY = atof(f[4]);
+			envi->pixsizeX = atof(f[5]);
+			envi->pixsizeY = atof(f[6]);
+			for(i=7; i<n; i++){
+				if((p = hdr_key(f[i], "units")) != NULL){
+					snprintf(envi->unit, sizeof(envi->unit), "%s", p);
+				}
+				else if((p = hdr_key(f[i], "rotation")) != NULL){
+					envi->rotation = atof(p);
+				}
+				else if(strchr(f[i], '=') != NULL){
+					continue;
+				}
+				else if(strcmp(envi->proj, "UTM") == 0 && i == 7){
+					envi->utmzone = atoi(f[i]);
+				}
+				else if(strcmp(envi->proj, "UTM") == 0 && i == 8){
+					snprintf(envi->orig, sizeof(envi->orig), "%s", f[i]);
+				}
+				else{
+					snprintf(envi->datum, sizeof(envi->datum), "%s", f[i]);
+				}
+			}
 			envi->have_map = 1;
 		}	
+		// projection info = {type, parameters.., [datum, ]name[, units=..]}
+		if(strncmp(line, "projection info", 15) == 0){
+			n = hdr_list(fp, line, sizeof(line), f, 32);
+			if(n < 1){
+				fclose(fp);
+				return -1;
+			}
+			envi->proj_type = atoi(f[0]);
+			for(i=1; i<n && envi->nproj_param<ENVI_MAX_PARAM; i++){
+				v = strtod(f[i], &end);
+				if(end == f[i] || *end != 0){
+					break;
+				}
+				envi->proj_param[envi->nproj_param++] = v;
+			}
+			envi->have_proj = 1;
+		}	
 	}
 	
 	fclose(fp);
 	return 0;
 }
+
+/* Gain and offset of each of the nband bands: the data gain values, or
+ * 1 / the scale factor, or without either 1 / dscale for integer data
+ * and 1 for floating point, which holds the values themselves; the data
+ * offset values, or 0. Bands past those listed take the first band's.
+ */
+void envi_gain(const ENVI_HDR *envi, double dscale, double *gain, double *offset)
+{
+	int b;
+
+	for(b=0; b<envi->nband; b++){
+		if(envi->ngain > 0){
+			gain[b] = envi->gain[b < envi->ngain ? b : 0];
+		}
+		else{
+			int fp = envi->dtype == 4 || envi->dtype == 5;
+			gain[b] = 1.0 / (envi->has_scale ? envi->scale : fp ? 1.0 : dscale);
+		}
+		offset[b] = envi->noffset > 0 ? envi->offset[b < envi->noffset ? b : 0] : 0.0;
+	}
+}
+
+// bytes per value of an ENVI data type, 0 for complex and unknown types
+int envi_dsize(int dtype)
+{
+	switch(dtype){
+	case 1:
+		return 1;
+	case 2:
+	case 12:
+		return 2;
+	case 3:
+	case 4:
+	case 13:
+		return 4;
+	case 5:
+	case 14:
+	case 15:
+		return 8;
+	}
+	return 0;
+}
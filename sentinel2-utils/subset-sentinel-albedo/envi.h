@@ -1,26 +1,68 @@
 #ifndef __INC_ENVI_H
 #define __INC_ENVI_H
 
+// interleave codes
+#define ENVI_BSQ (0)
+#define ENVI_BIL (1)
+#define ENVI_BIP (2)
+
+// ENVI projection types of the projection info
+#define ENVI_PROJ_GEO (1)
+#define ENVI_PROJ_UTM (2)
+#define ENVI_PROJ_ALBERS (9)
+#define ENVI_PROJ_SNSOID (16)
+#define ENVI_PROJ_PS (31)
+
+#define ENVI_MAX_PARAM (16)
+
+// bands with their own gain, offset and name; later bands take those of the first, or no name
+#define ENVI_MAX_BAND (64)
+#define ENVI_MAX_NAME (32)
+
 typedef struct{
 	int nrow;
 	int ncol;
 	int nband;
 	int dtype;
+	int byteorder;		// 0 little endian, 1 big endian
+	long long hoffset;	// bytes before the first value
+	int has_ignore;
+	double ignore;		// data ignore value, the fill of missing pixels
+	/* physical value = gain * value + offset, per band, ENVI's data gain
+	 * values and data offset values, the offset in physical units; without
+	 * gain values a reflectance scale factor gives gain 1 / scale
+	 */
+	int has_scale;
+	double scale;
+	int ngain;
+	double gain[ENVI_MAX_BAND];
+	int noffset;
+	double offset[ENVI_MAX_BAND];
+	int nbname;
+	char bname[ENVI_MAX_BAND][ENVI_MAX_NAME];	// band names
 	char interleave[10];
+	int il;
 	int have_map;
-	char proj[10];
-	double tieX;
+	char proj[64];		// map info projection name
+	double tieX;		// image pixel, from 1, of the map tie point
 	double tieY;
 	double upleftX;
 	double upleftY;
 	double pixsizeX;
 	double pixsizeY;
 	int utmzone;
-	char orig[10];
-	char datum[10];
-	char unit[10];
+	char orig[10];		// UTM hemisphere, North or South
+	char datum[64];
+	char unit[16];
+	double rotation;	// degrees, 0 for a north up grid
+	int have_proj;
+	int proj_type;		// ENVI projection type code of the projection info
+	int nproj_param;
+	double proj_param[ENVI_MAX_PARAM];	// its numeric parameters, in order
 }ENVI_HDR;
 
 int read_envi_hdr(char *hdr, ENVI_HDR *envi);
+int envi_dsize(int dtype);
+void envi_gain(const ENVI_HDR *envi, double dscale, double *gain, double *offset);
 
 #endif
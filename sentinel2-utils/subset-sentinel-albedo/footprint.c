@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include "footprint.h"
+
+static unsigned long fp_hash(int shape, int area, double size, double pix_y, double pix_x, double fy, double fx)
+{
+	double key[5];
+	unsigned char *p = (unsigned char *)key;
+	unsigned long h = 2166136261UL ^ (unsigned long)(shape*2 + area);
+	size_t i;
+
+	key[0] = size;
+	key[1] = pix_y;
+	key[2] = pix_x;
+	key[3] = fy;
+	key[4] = fx;
+	for(i=0; i<sizeof(key); i++){
+		h = (h ^ p[i]) * 16777619UL;
+	}
+	return h;
+}
+
+// integral of sqrt(r*r - t*t) from 0 to x, |x| <= r
+static double disc_prim(double x, double r)
+{
+	return 0.5 * (x*sqrt(r*r - x*x) + r*r*asin(x/r));
+}
+
+/* Area of the disc of radius r at the origin inside [x0,x1] x [y0,y1].
+ * Between the breakpoints, where the circle crosses a rectangle side,
+ * the top and bottom of the intersection are each either a side or the
+ * circle, so each piece integrates in closed form.
+ */
+static double disc_rect(double r, double x0, double x1, double y0, double y1)
+{
+	double b[6], y[2], a = 0.0;
+	int nb = 0, i, j;
+
+	x0 = x0 > -r ? x0 : -r;
+	x1 = x1 < r ? x1 : r;
+	if(x1 <= x0 || y1 <= y0){
+		return 0.0;
+	}
+	b[nb++] = x0;
+	b[nb++] = x1;
+	y[0] = y0;
+	y[1] = y1;
+	for(i=0; i<2; i++){
+		if(fabs(y[i]) < r){
+			double t = sqrt(r*r - y[i]*y[i]);
+			if(t > x0 && t < x1){
+				b[nb++] = t;
+			}
+			if(-t > x0 && -t < x1){
+				b[nb++] = -t;
+			}
+		}
+	}
+	for(i=1; i<nb; i++){
+		double t = b[i];
+		for(j=i; j>0 && b[j-1]>t; j--){
+			b[j] = b[j-1];
+		}
+		b[j] = t;
+	}
+	for(i=0; i+1<nb; i++){
+		double u = b[i], v = b[i+1], m = 0.5*(u+v);
+		double h = sqrt(r*r - m*m);
+		if((y1 < h ? y1 : h) <= (y0 > -h ? y0 : -h)){
+			continue;
+		}
+		a += y1 < h ? y1*(v-u) : disc_prim(v, r) - disc_prim(u, r);
+		a -= y0 > -h ? y0*(v-u) : -(disc_prim(v, r) - disc_prim(u, r));
+	}
+	return a;
+}
+
+// overlap of [a, a+1] with [lo, hi]
+static double span_overlap(double a, double lo, double hi)
+{
+	double s = (a > lo ? a : lo);
+	double e = (a+1 < hi ? a+1 : hi);
+	return e > s ? e - s : 0.0;
+}
+
+/* Area footprint: every pixel the exact square or circle overlaps, with
+ * its overlap as weight. Runs are trimmed to the pixels of positive
+ * weight. In pixels the circle is an ellipse, rows stretched by as, so
+ * a pixel's overlap is that of the circle of radius rx with the pixel
+ * stretched by as, shrunk back.
+ */
+static int fp_build_area(FOOTPRINT *fp)
+{
+	double ry = fp->size / 2 / fp->pix_y, rx = fp->size / 2 / fp->pix_x;
+	double as = rx / ry;
+	int i, c, n, nc;
+
+	fp->r0 = (int)floor(fp->fy - ry);
+	fp->r1 = (int)ceil(fp->fy + ry) - 1;
+	fp->cmin = (int)floor(fp->fx - rx);
+	fp->cmax = (int)ceil(fp->fx + rx) - 1;
+	n = fp->r1 - fp->r0 + 1;
+	nc = fp->cmax - fp->cmin + 1;
+	fp->cs = (int *)malloc(2*n*sizeof(int));
+	fp->wt = (double *)calloc((long)n*nc, sizeof(double));
+	if(fp->cs == NULL || fp->wt == NULL){
+		return -1;
+	}
+	fp->ce = fp->cs + n;
+
+	for(i=0; i<n; i++){
+		double *w = fp->wt + (long)i*nc;
+		double y = fp->r0 + i - fp->fy;
+		for(c=0; c<nc; c++){
+			double x = fp->cmin + c - fp->fx;
+			if(fp->shape == FP_SQUARE){
+				w[c] = span_overlap(y, -ry, ry) * span_overlap(x, -rx, rx);
+			}
+			else{
+				w[c] = disc_rect(rx, x, x+1, y*as, (y+1)*as) / as;
+			}
+		}
+		for(c=0; c<nc && w[c]<=0.0; c++);
+		fp->cs[i] = fp->cmin + c;
+		for(c=nc-1; c>=0 && w[c]<=0.0; c--);
+		fp->ce[i] = fp->cmin + c + 1;
+		if(fp->ce[i] < fp->cs[i]){
+			fp->ce[i] = fp->cs[i];
+		}
+	}
+	return 0;
+}
+
+static FOOTPRINT *fp_build(int shape, int area, double size, double pix_y, double pix_x, double fy, double fx)
+{
+	FOOTPRINT *fp = (FOOTPRINT *)calloc(1, sizeof(FOOTPRINT));
+	double ry = size / 2 / pix_y, rx = size / 2 / pix_x;
+	int i, n, nx = size / pix_x;
+
+	if(fp == NULL){
+		return NULL;
+	}
+	fp->shape = shape;
+	fp->area = area;
+	fp->size = size;
+	fp->pix_y = pix_y;
+	fp->pix_x = pix_x;
+	fp->fy = fy;
+	fp->fx = fx;
+
+	if(area){
+		if(0 != fp_build_area(fp)){
+			free(fp->cs);
+			free(fp->wt);
+			free(fp);
+			return NULL;
+		}
+		return fp;
+	}
+
+	if(shape == FP_SQUARE){
+		int np = size / pix_y;
+		fp->r0 = -(np/2);
+		fp->r1 = np/2;
+	}
+	else{
+		// rows whose pixel centres i+0.5 lie within the radius of fy
+		fp->r0 = (int)ceil(fy - ry - 0.5);
+		fp->r1 = (int)floor(fy + ry - 0.5);
+		if(fp->r1 < fp->r0){
+			fp->r0 = 0;
+			fp->r1 = 0;
+		}
+	}
+
+	n = fp->r1 - fp->r0 + 1;
+	fp->cs = (int *)malloc(2*n*sizeof(int));
+	if(fp->cs == NULL){
+		free(fp);
+		return NULL;
+	}
+	fp->ce = fp->cs + n;
+
+	for(i=0; i<n; i++){
+		if(shape == FP_SQUARE){
+			fp->cs[i] = -(nx/2);
+			fp->ce[i] = nx/2 + 1;
+			continue;
+		}
+		double dy = (fp->r0 + i + 0.5 - fy) / ry;
+		double h = 1 - dy*dy;
+		if(h < 0){
+			fp->cs[i] = fp->ce[i] = 0;
+			continue;
+		}
+		h = rx * sqrt(h);
+		fp->cs[i] = (int)ceil(fx - h - 0.5);
+		fp->ce[i] = (int)floor(fx + h - 0.5) + 1;
+		if(fp->ce[i] < fp->cs[i]){
+			fp->ce[i] = fp->cs[i];
+		}
+	}
+	fp->cmin = 0;
+	fp->cmax = -1;
+	for(i=0; i<n; i++){
+		if(fp->ce[i] <= fp->cs[i]){
+			continue;
+		}
+		if(fp->cmax < fp->cmin){
+			fp->cmin = fp->cs[i];
+			fp->cmax = fp->ce[i] - 1;
+		}
+		if(fp->cs[i] < fp->cmin){
+			fp->cmin = fp->cs[i];
+		}
+		if(fp->ce[i] - 1 > fp->cmax){
+			fp->cmax = fp->ce[i] - 1;
+		}
+	}
+	if(fp->cmax < fp->cmin){
+		// no pixel centre inside a circle smaller than a pixel: take the
+		// pixel under the centre
+		fp->r0 = fp->r1 = 0;
+		fp->cs[0] = fp->cmin = fp->cmax = 0;
+		fp->ce[0] = 1;
+	}
+	return fp;
+}
+
+/* Run table of a footprint centred at (fy, fx) inside its pixel, built on
+ * first use. The same site over the images of one tile, or sites sharing
+ * a grid offset, get the table back without recomputing it.
+ */
+const FOOTPRINT *fp_get(FP_CACHE *cache, int shape, int area, double size, double pix_y, double pix_x, double fy, double fx)
+{
+	FOOTPRINT *fp;
+	unsigned long h;
+	int i;
+
+	if(shape == FP_SQUARE && !area){
+		fy = 0;
+		fx = 0;
+	}
+
+	if(cache->n >= cache->nslot){
+		// grow and rehash
+		int nslot = cache->nslot > 0 ? cache->nslot*2 : 64;
+		FOOTPRINT **slot = (FOOTPRINT **)calloc(nslot, sizeof(FOOTPRINT *));
+		if(slot == NULL){
+			return NULL;
+		}
+		for(i=0; i<cache->nslot; i++){
+			while((fp = cache->slot[i]) != NULL){
+				cache->slot[i] = fp->next;
+				h = fp_hash(fp->shape, fp->area, fp->size, fp->pix_y, fp->pix_x, fp->fy, fp->fx) % nslot;
+				fp->next = slot[h];
+				slot[h] = fp;
+			}
+		}
+		free(cache->slot);
+		cache->slot = slot;
+		cache->nslot = nslot;
+	}
+
+	h = fp_hash(shape, area, size, pix_y, pix_x, fy, fx) % cache->nslot;
+	for(fp=cache->slot[h]; fp!=NULL; fp=fp->next){
+		if(fp->shape == shape && fp->area == area && fp->size == size && fp->pix_y == pix_y && fp->pix_x == pix_x
+				&& fp->fy == fy && fp->fx == fx){
+			return fp;
+		}
+	}
+
+	fp = fp_build(shape, area, size, pix_y, pix_x, fy, fx);
+	if(fp == NULL){
+		return NULL;
+	}
+	fp->next = cache->slot[h];
+	cache->slot[h] = fp;
+	cache->n++;
+	return fp;
+}
+
+void fp_free_cache(FP_CACHE *cache)
+{
+	FOOTPRINT *fp;
+	int i;
+
+	for(i=0; i<cache->nslot; i++){
+		while((fp = cache->slot[i]) != NULL){
+			cache->slot[i] = fp->next;
+			free(fp->cs);
+			free(fp->wt);
+			free(fp);
+		}
+	}
+	free(cache->slot);
+	cache->slot = NULL;
+	cache->nslot = 0;
+	cache->n = 0;
+}
+
+// weights of row r0+i of an area footprint from column c on
+const double *fp_weights(const FOOTPRINT *fp, int i, int c)
+{
+	return fp->wt + (long)i*(fp->cmax - fp->cmin + 1) + c - fp->cmin;
+}
+
+// shape code of "square" or "circle", -1 otherwise
+int fp_shape(char *name)
+{
+	if(strcasecmp(name, "square") == 0){
+		return FP_SQUARE;
+	}
+	if(strcasecmp(name, "circle") == 0){
+		return FP_CIRCLE;
+	}
+	return -1;
+}
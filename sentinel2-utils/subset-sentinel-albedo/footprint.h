@@ -0,0 +1,49 @@
+#ifndef __INC_FOOTPRINT_H
+#define __INC_FOOTPRINT_H
+
+// footprint shapes
+#define FP_SQUARE (0)
+#define FP_CIRCLE (1)
+
+/* Pixels of a footprint as one column run per row, relative to the pixel
+ * holding the centre: row r0+i covers columns [cs[i], ce[i]), which may
+ * be empty. A circle takes the pixels whose centre lies within the
+ * diameter, so the runs depend on where in its pixel the centre falls.
+ * A square is the original window of size/pix_y rows by size/pix_x
+ * columns and ignores it. Rows and columns of different ground spacing
+ * keep the footprint square or round on the ground.
+ * An area footprint instead takes every pixel it overlaps, with wt the
+ * overlap of each, in pixels, row by row over columns cmin..cmax; the
+ * exact square or circle is placed at the centre position.
+ */
+typedef struct FOOTPRINT{
+	int shape;
+	int area;
+	double size;		// window side or circle diameter, map units
+	double pix_y;		// ground spacing of the rows and of the columns
+	double pix_x;
+	double fy;		// centre position inside its pixel, 0..1
+	double fx;
+	int r0;			// row span relative to the centre pixel
+	int r1;
+	int cmin;		// column bounds of all runs, cmax inclusive
+	int cmax;
+	int *cs;
+	int *ce;
+	double *wt;		// NULL for whole pixels
+	struct FOOTPRINT *next;
+}FOOTPRINT;
+
+// run tables built so far, hashed by (shape, area, size, pix_y, pix_x, fy, fx)
+typedef struct{
+	FOOTPRINT **slot;
+	int nslot;
+	int n;
+}FP_CACHE;
+
+const FOOTPRINT *fp_get(FP_CACHE *cache, int shape, int area, double size, double pix_y, double pix_x, double fy, double fx);
+const double *fp_weights(const FOOTPRINT *fp, int i, int c);
+void fp_free_cache(FP_CACHE *cache);
+int fp_shape(char *name);
+
+#endif
@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "geoloc.h"
+
+// finest node spacing worth interpolating; below it every pixel is transformed
+#define GEO_MIN_STEP (4)
+// nodes and check points of a tile at the finest spacing
+#define GEO_MAXPT ((GEO_TILE/GEO_MIN_STEP+1)*(GEO_TILE/GEO_MIN_STEP+1) + (GEO_TILE/GEO_MIN_STEP)*(GEO_TILE/GEO_MIN_STEP))
+
+// the window and its planes, with the next tile to take under lock
+typedef struct{
+	const SPACE *sp;
+	int r1;
+	int c1;
+	int nrow;
+	int ncol;
+	double *lat;
+	double *lon;
+	double maxerr;
+	int ntx;
+	int nty;
+	int next;
+	int failed;
+	GEO_STATS st;
+	pthread_mutex_t lock;
+}GEO_JOB;
+
+// transform buffers of one thread
+typedef struct{
+	double *l;
+	double *s;
+	double *lat;
+	double *lon;
+}GEO_WORK;
+
+// every pixel of tile rows y0..y1, columns x0..x1 of the window, through the batch inverse
+static int geo_exact(GEO_JOB *job, int y0, int y1, int x0, int x1)
+{
+	double l[GEO_TILE], s[GEO_TILE];
+	int y, x, ret = 0;
+
+	for(x=x0; x<=x1; x++){
+		s[x-x0] = job->c1 + x + 0.5;
+	}
+	for(y=y0; y<=y1; y++){
+		long off = (long)y*job->ncol + x0;
+		for(x=x0; x<=x1; x++){
+			l[x-x0] = job->r1 + y + 0.5;
+		}
+		if(0 != space_from_n(job->sp, l, s, job->lat + off, job->lon + off, x1-x0+1)){
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+// nodes of a tile side of n pixels at spacing h, the last at n-1; returns how many
+static int geo_nodes(int n, int h, int *p)
+{
+	int i, k = 0;
+
+	for(i=0; i<n-1; i+=h){
+		p[k++] = i;
+	}
+	p[k++] = n-1;
+	return k;
+}
+
+/* Tile rows y0..y1, columns x0..x1 interpolated from nodes at spacing h:
+ * the nodes and the centres of the cells between them are transformed
+ * exactly, and the tile is filled only when the interpolation of every
+ * centre is within maxerr. Returns -1 otherwise, with *err the error.
+ */
+static int geo_interp(GEO_JOB *job, GEO_WORK *w, int y0, int y1, int x0, int x1, int h, double *err)
+{
+	int py[GEO_TILE+1], px[GEO_TILE+1], kx[GEO_TILE];
+	double tx[GEO_TILE];
+	int ny = geo_nodes(y1-y0+1, h, py);
+	int nx = geo_nodes(x1-x0+1, h, px);
+	int nn = ny*nx;
+	int i, j, k, y, x;
+	double e = 0;
+
+	for(i=0, k=0; i<ny; i++){
+		for(j=0; j<nx; j++, k++){
+			w->l[k] = job->r1 + y0 + py[i] + 0.5;
+			w->s[k] = job->c1 + x0 + px[j] + 0.5;
+		}
+	}
+	for(i=0; i<ny-1; i++){
+		for(j=0; j<nx-1; j++, k++){
+			w->l[k] = job->r1 + y0 + (py[i] + py[i+1]) / 2.0 + 0.5;
+			w->s[k] = job->c1 + x0 + (px[j] + px[j+1]) / 2.0 + 0.5;
+		}
+	}
+	if(0 != space_from_n(job->sp, w->l, w->s, w->lat, w->lon, k)){
+		*err = INFINITY;
+		return -1;
+	}
+
+	// the centre of a cell is the mean of its four corners
+	for(i=0, k=nn; i<ny-1; i++){
+		for(j=0; j<nx-1; j++, k++){
+			const int a = i*nx + j;
+			double la = (w->lat[a] + w->lat[a+1] + w->lat[a+nx] + w->lat[a+nx+1]) / 4;
+			double lo = (w->lon[a] + w->lon[a+1] + w->lon[a+nx] + w->lon[a+nx+1]) / 4;
+			double dy = la - w->lat[k];
+			double dx = (lo - w->lon[k]) * cos(w->lat[k] * (M_PI/180));
+			double d = GEO_M_PER_DEG * sqrt(dy*dy + dx*dx);
+			e = d > e ? d : e;
+		}
+	}
+	*err = e;
+	if(!(e <= job->maxerr)){
+		return -1;
+	}
+
+	for(x=0, j=0; x<=x1-x0; x++){
+		while(px[j+1] < x){
+			j++;
+		}
+		kx[x] = j;
+		tx[x] = (double)(x - px[j]) / (px[j+1] - px[j]);
+	}
+	for(y=0, i=0; y<=y1-y0; y++){
+		while(py[i+1] < y){
+			i++;
+		}
+		const double ty = (double)(y - py[i]) / (py[i+1] - py[i]);
+		const double *la0 = w->lat + i*nx, *la1 = la0 + nx;
+		const double *lo0 = w->lon + i*nx, *lo1 = lo0 + nx;
+		double *lat = job->lat + (long)(y0+y)*job->ncol + x0;
+		double *lon = job->lon + (long)(y0+y)*job->ncol + x0;
+		for(x=0; x<=x1-x0; x++){
+			const int c = kx[x];
+			const double t = tx[x];
+			lat[x] = (1-ty) * ((1-t)*la0[c] + t*la0[c+1]) + ty * ((1-t)*la1[c] + t*la1[c+1]);
+			lon[x] = (1-ty) * ((1-t)*lo0[c] + t*lo0[c+1]) + ty * ((1-t)*lo1[c] + t*lo1[c+1]);
+		}
+	}
+	return 0;
+}
+
+/* Take tiles until none is left. Interpolation starts from twice the
+ * spacing the last tile took, as neighbouring tiles need about the same.
+ */
+static void *geo_worker(void *arg)
+{
+	GEO_JOB *job = (GEO_JOB *)arg;
+	GEO_WORK w;
+	int h = GEO_TILE / 2;
+	int t, ret, interp;
+	double e, emax;
+
+	w.l = (double *)malloc(4L*GEO_MAXPT*sizeof(double));
+	if(w.l == NULL){
+		pthread_mutex_lock(&job->lock);
+		job->failed = 1;
+		pthread_mutex_unlock(&job->lock);
+		return NULL;
+	}
+	w.s = w.l + GEO_MAXPT;
+	w.lat = w.s + GEO_MAXPT;
+	w.lon = w.lat + GEO_MAXPT;
+
+	for(;;){
+		pthread_mutex_lock(&job->lock);
+		t = job->next++;
+		pthread_mutex_unlock(&job->lock);
+		if(t >= job->ntx*job->nty){
+			break;
+		}
+		const int y0 = (t / job->ntx) * GEO_TILE;
+		const int x0 = (t % job->ntx) * GEO_TILE;
+		const int y1 = y0 + GEO_TILE <= job->nrow ? y0 + GEO_TILE - 1 : job->nrow - 1;
+		const int x1 = x0 + GEO_TILE <= job->ncol ? x0 + GEO_TILE - 1 : job->ncol - 1;
+
+		interp = 0;
+		emax = 0;
+		if(job->maxerr > 0 && y1 > y0 && x1 > x0){
+			for(h=(h < GEO_TILE ? 2*h : GEO_TILE); h>=GEO_MIN_STEP; h/=2){
+				if(0 == geo_interp(job, &w, y0, y1, x0, x1, h, &e)){
+					interp = 1;
+					emax = e;
+					break;
+				}
+			}
+			h = h < GEO_MIN_STEP ? GEO_MIN_STEP : h;
+		}
+		ret = interp ? 0 : geo_exact(job, y0, y1, x0, x1);
+
+		pthread_mutex_lock(&job->lock);
+		job->failed |= ret != 0;
+		job->st.ninterp += interp;
+		job->st.maxerr = emax > job->st.maxerr ? emax : job->st.maxerr;
+		pthread_mutex_unlock(&job->lock);
+	}
+	free(w.l);
+	return NULL;
+}
+
+int geo_grid(const SPACE *sp, int r1, int r2, int c1, int c2, double *lat, double *lon, int nthread, double maxerr, GEO_STATS *st)
+{
+	pthread_t *tid = NULL;
+	GEO_JOB job;
+	int i, n = 0;
+
+	memset(&job, 0, sizeof(GEO_JOB));
+	job.sp = sp;
+	job.r1 = r1;
+	job.c1 = c1;
+	job.nrow = r2 - r1 + 1;
+	job.ncol = c2 - c1 + 1;
+	job.lat = lat;
+	job.lon = lon;
+	job.maxerr = maxerr;
+	job.nty = (job.nrow + GEO_TILE - 1) / GEO_TILE;
+	job.ntx = (job.ncol + GEO_TILE - 1) / GEO_TILE;
+	pthread_mutex_init(&job.lock, NULL);
+
+	if(nthread > job.ntx*job.nty){
+		nthread = job.ntx*job.nty;
+	}
+	if(nthread > 1){
+		tid = (pthread_t *)malloc(nthread*sizeof(pthread_t));
+	}
+	for(i=0; tid!=NULL && i<nthread; i++){
+		if(0 != pthread_create(&tid[n], NULL, geo_worker, &job)){
+			break;
+		}
+		n++;
+	}
+	if(n == 0){
+		geo_worker(&job);
+	}
+	for(i=0; i<n; i++){
+		pthread_join(tid[i], NULL);
+	}
+	free(tid);
+	pthread_mutex_destroy(&job.lock);
+
+	job.st.npix = (long long)job.nrow * job.ncol;
+	job.st.ntile = job.ntx * job.nty;
+	if(st != NULL){
+		*st = job.st;
+	}
+	return job.failed ? -1 : 0;
+}
+
+// header of the grid: the map info moved to the window, the projection info as read
+static int geo_header(char *fout, const ENVI_HDR *envi, int r1, int r2, int c1, int c2)
+{
+	char hdr[4096];
+	char *dot = strrchr(fout, '.');
+	union{
+		int i;
+		char c;
+	}order = {1};
+	FILE *fp;
+	int i;
+
+	if(dot == NULL || strchr(dot, '/') != NULL){
+		snprintf(hdr, sizeof(hdr), "%s.hdr", fout);
+	}
+	else{
+		snprintf(hdr, sizeof(hdr), "%.*s.hdr", (int)(dot - fout), fout);
+	}
+	fp = fopen(hdr, "w");
+	if(fp == NULL){
+		fprintf(stderr, "CAN NOT WRITE %s\n", hdr);
+		return -1;
+	}
+	fprintf(fp, "ENVI\n");
+	fprintf(fp, "description = {latitude and longitude of the pixel centres, degrees}\n");
+	fprintf(fp, "samples = %d\nlines = %d\nbands = 2\nheader offset = 0\n", c2-c1+1, r2-r1+1);
+	fprintf(fp, "file type = ENVI Standard\ndata type = 5\ninterleave = bsq\nbyte order = %d\n", order.c ? 0 : 1);
+	fprintf(fp, "band names = {latitude, longitude}\n");
+	fprintf(fp, "map info = {%s, 1.000, 1.000, %.12g, %.12g, %.12g, %.12g", envi->proj,
+			envi->upleftX + (c1 - envi->tieX + 1) * envi->pixsizeX, envi->upleftY - (r1 - envi->tieY + 1) * envi->pixsizeY,
+			envi->pixsizeX, envi->pixsizeY);
+	if(strcmp(envi->proj, "UTM") == 0){
+		fprintf(fp, ", %d, %s", envi->utmzone, envi->orig);
+	}
+	if(envi->datum[0] != '\0'){
+		fprintf(fp, ", %s", envi->datum);
+	}
+	if(envi->unit[0] != '\0'){
+		fprintf(fp, ", units=%s", envi->unit);
+	}
+	fprintf(fp, "}\n");
+	if(envi->have_proj){
+		fprintf(fp, "projection info = {%d", envi->proj_type);
+		for(i=0; i<envi->nproj_param; i++){
+			fprintf(fp, ", %.12g", envi->proj_param[i]);
+		}
+		fprintf(fp, ", %s}\n", envi->proj);
+	}
+	fclose(fp);
+	return 0;
+}
+
+int geo_write(char *fout, const ENVI_HDR *envi, const SPACE *sp, int r1, int r2, int c1, int c2, int nthread, double maxerr, GEO_STATS *st)
+{
+	long long n = (long long)(r2 - r1 + 1) * (c2 - c1 + 1);
+	size_t size = 2 * n * sizeof(double);
+	double *map;
+	int fd, ret;
+
+	fd = open(fout, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0 || 0 != ftruncate(fd, (off_t)size)){
+		fprintf(stderr, "CAN NOT WRITE %s\n", fout);
+		if(fd >= 0){
+			close(fd);
+		}
+		return -1;
+	}
+	map = (double *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == (double *)MAP_FAILED){
+		fprintf(stderr, "CAN NOT MAP %s\n", fout);
+		return -1;
+	}
+	ret = geo_grid(sp, r1, r2, c1, c2, map, map + n, nthread, maxerr, st);
+	if(0 != msync(map, size, MS_SYNC)){
+		ret = -1;
+	}
+	munmap(map, size);
+	if(ret != 0){
+		fprintf(stderr, "PROJECTION FAILED FOR SOME PIXELS, WRITTEN AS NAN. %s\n", fout);
+	}
+	return geo_header(fout, envi, r1, r2, c1, c2) == 0 ? ret : -1;
+}
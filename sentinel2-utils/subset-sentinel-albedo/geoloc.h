@@ -0,0 +1,36 @@
+#ifndef __INC_GEOLOC_H
+#define __INC_GEOLOC_H
+
+#include "envi.h"
+#include "space.h"
+
+// tile edge in pixels, the unit of work of a thread
+#define GEO_TILE (256)
+
+// metres of one degree of latitude, to weigh interpolation errors
+#define GEO_M_PER_DEG (111320.0)
+
+typedef struct{
+	long long npix;
+	int ntile;
+	int ninterp;		// tiles interpolated from a coarse grid
+	double maxerr;		// largest error measured on them, metres
+}GEO_STATS;
+
+/* Latitude and longitude of the centre of every pixel of rows r1..r2 and
+ * columns c1..c2 of grid sp, in degrees, into the nrow x ncol planes lat
+ * and lon. The window is cut into GEO_TILE tiles shared by nthread
+ * threads. With maxerr > 0 a tile is interpolated bilinearly from the
+ * exact transform on a coarse grid of nodes, the coarsest whose error at
+ * the cell centres, where it peaks, is within maxerr metres; tiles that
+ * need a node at every pixel are transformed exactly.
+ */
+int geo_grid(const SPACE *sp, int r1, int r2, int c1, int c2, double *lat, double *lon, int nthread, double maxerr, GEO_STATS *st);
+
+/* Write the grid of rows r1..r2 and columns c1..c2 of the image of header
+ * envi as an ENVI float64 image fout of two bands, latitude and longitude,
+ * with the map info of the window.
+ */
+int geo_write(char *fout, const ENVI_HDR *envi, const SPACE *sp, int r1, int r2, int c1, int c2, int nthread, double maxerr, GEO_STATS *st);
+
+#endif
@@ -0,0 +1,953 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "envi.h"
+#include "kernel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERN_X86
+#include <immintrin.h>
+#endif
+
+/* The vector kernels widen each 16-bit value to a 32-bit lane. Lane l of
+ * vector k in a period belongs to band (lanes*k+l) % nband, and a period
+ * of nband/gcd(nband,lanes) vectors starts again at band 0, so lanes are
+ * accumulated separately and folded into bands at the end. Per-lane 32-bit
+ * sums are flushed every KERN_FLUSH periods, before they could overflow;
+ * squares go straight to 64-bit lanes. Up to KERN_MAX_BAND bands, more
+ * take the scalar path.
+ */
+#define KERN_MAX_BAND (16)
+#define KERN_FLUSH (32768)
+
+void kern_stats_scalar(const short *p, long npix, int nband, int nodata, long long *cnt, long long *sum, long long *sumsq)
+{
+	long i;
+	int b;
+
+	for(i=0; i<npix; i++){
+		for(b=0; b<nband; b++){
+			long long v = p[i*nband+b];
+			if(v != nodata){
+				cnt[b]++;
+				sum[b] += v;
+				sumsq[b] += v*v;
+			}
+		}
+	}
+}
+
+static int kern_period(int nband, int lanes)
+{
+	int a = nband, b = lanes, t;
+	while(b != 0){
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return nband / a;
+}
+
+/* Reverse the byte order of n bytes of dsize-byte values from src to
+ * dst, which may be the same buffer.
+ */
+static void bswap_scalar(void *dst, const void *src, size_t n, int dsize)
+{
+	unsigned char *d = (unsigned char *)dst;
+	const unsigned char *p = (const unsigned char *)src;
+	size_t i;
+
+	switch(dsize){
+	case 2:
+		for(i=0; i+2<=n; i+=2){
+			unsigned short v;
+			memcpy(&v, p+i, 2);
+			v = __builtin_bswap16(v);
+			memcpy(d+i, &v, 2);
+		}
+		break;
+	case 4:
+		for(i=0; i+4<=n; i+=4){
+			unsigned int v;
+			memcpy(&v, p+i, 4);
+			v = __builtin_bswap32(v);
+			memcpy(d+i, &v, 4);
+		}
+		break;
+	case 8:
+		for(i=0; i+8<=n; i+=8){
+			unsigned long long v;
+			memcpy(&v, p+i, 8);
+			v = __builtin_bswap64(v);
+			memcpy(d+i, &v, 8);
+		}
+		break;
+	default:
+		if(d != p){
+			memmove(d, p, n);
+		}
+	}
+}
+
+#ifdef KERN_X86
+
+// byte shuffle reversing each 2-, 4- or 8-byte value of a 16-byte lane
+static const char bswap_mask[3][16] = {
+	{1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14},
+	{3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12},
+	{7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8},
+};
+
+static __attribute__((target("sse4.2"))) void bswap_sse42(void *dst, const void *src, size_t n, int dsize)
+{
+	const char *p = (const char *)src;
+	char *d = (char *)dst;
+	size_t i = 0;
+
+	if(dsize == 2 || dsize == 4 || dsize == 8){
+		__m128i m = _mm_loadu_si128((const __m128i *)bswap_mask[dsize == 2 ? 0 : (dsize == 4 ? 1 : 2)]);
+		for(; i+16<=n; i+=16){
+			__m128i v = _mm_loadu_si128((const __m128i *)(p+i));
+			_mm_storeu_si128((__m128i *)(d+i), _mm_shuffle_epi8(v, m));
+		}
+	}
+	bswap_scalar(d+i, p+i, n-i, dsize);
+}
+
+// also serves the AVX-512 set, which does not require AVX512BW
+static __attribute__((target("avx2"))) void bswap_avx2(void *dst, const void *src, size_t n, int dsize)
+{
+	const char *p = (const char *)src;
+	char *d = (char *)dst;
+	size_t i = 0;
+
+	if(dsize == 2 || dsize == 4 || dsize == 8){
+		__m128i h = _mm_loadu_si128((const __m128i *)bswap_mask[dsize == 2 ? 0 : (dsize == 4 ? 1 : 2)]);
+		__m256i m = _mm256_broadcastsi128_si256(h);
+		for(; i+32<=n; i+=32){
+			__m256i v = _mm256_loadu_si256((const __m256i *)(p+i));
+			_mm256_storeu_si256((__m256i *)(d+i), _mm256_shuffle_epi8(v, m));
+		}
+	}
+	bswap_sse42(d+i, p+i, n-i, dsize);
+}
+
+// 4 lanes
+static inline __attribute__((always_inline, target("sse4.2")))
+void stats_sse42(const short *p, long npix, int nband, int nodata, long long *cnt, long long *sum, long long *sumsq)
+{
+	int per = kern_period(nband, 4);
+	long nit = npix*nband / (4*per);
+	const short *q = p;
+	const __m128i nd = _mm_set1_epi32(nodata);
+	__m128i vs[KERN_MAX_BAND], vb[KERN_MAX_BAND], ve[KERN_MAX_BAND], vo[KERN_MAX_BAND];
+	int s32[4], b32[4];
+	long long q64[2];
+	long it = 0, start;
+	int k, l;
+
+	for(k=0; k<per; k++){
+		ve[k] = _mm_setzero_si128();
+		vo[k] = _mm_setzero_si128();
+	}
+	while(it < nit){
+		start = it;
+		for(k=0; k<per; k++){
+			vs[k] = _mm_setzero_si128();
+			vb[k] = _mm_setzero_si128();
+		}
+		for(; it<nit && it-start<KERN_FLUSH; it++){
+			for(k=0; k<per; k++){
+				__m128i x = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)q));
+				__m128i bad = _mm_cmpeq_epi32(x, nd);
+				x = _mm_andnot_si128(bad, x);
+				vs[k] = _mm_add_epi32(vs[k], x);
+				vb[k] = _mm_sub_epi32(vb[k], bad);
+				ve[k] = _mm_add_epi64(ve[k], _mm_mul_epi32(x, x));
+				x = _mm_srli_epi64(x, 32);
+				vo[k] = _mm_add_epi64(vo[k], _mm_mul_epi32(x, x));
+				q += 4;
+			}
+		}
+		for(k=0; k<per; k++){
+			_mm_storeu_si128((__m128i *)s32, vs[k]);
+			_mm_storeu_si128((__m128i *)b32, vb[k]);
+			for(l=0; l<4; l++){
+				sum[(4*k+l)%nband] += s32[l];
+				cnt[(4*k+l)%nband] += it - start - b32[l];
+			}
+		}
+	}
+	for(k=0; k<per; k++){
+		_mm_storeu_si128((__m128i *)q64, ve[k]);
+		for(l=0; l<2; l++){
+			sumsq[(4*k+2*l)%nband] += q64[l];
+		}
+		_mm_storeu_si128((__m128i *)q64, vo[k]);
+		for(l=0; l<2; l++){
+			sumsq[(4*k+2*l+1)%nband] += q64[l];
+		}
+	}
+	kern_stats_scalar(q, npix - nit*4*per/nband, nband, nodata, cnt, sum, sumsq);
+}
+
+// 8 lanes
+static inline __attribute__((always_inline, target("avx2")))
+void stats_avx2(const short *p, long npix, int nband, int nodata, long long *cnt, long long *sum, long long *sumsq)
+{
+	int per = kern_period(nband, 8);
+	long nit = npix*nband / (8*per);
+	const short *q = p;
+	const __m256i nd = _mm256_set1_epi32(nodata);
+	__m256i vs[KERN_MAX_BAND], vb[KERN_MAX_BAND], ve[KERN_MAX_BAND], vo[KERN_MAX_BAND];
+	int s32[8], b32[8];
+	long long q64[4];
+	long it = 0, start;
+	int k, l;
+
+	for(k=0; k<per; k++){
+		ve[k] = _mm256_setzero_si256();
+		vo[k] = _mm256_setzero_si256();
+	}
+	while(it < nit){
+		start = it;
+		for(k=0; k<per; k++){
+			vs[k] = _mm256_setzero_si256();
+			vb[k] = _mm256_setzero_si256();
+		}
+		for(; it<nit && it-start<KERN_FLUSH; it++){
+			for(k=0; k<per; k++){
+				__m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)q));
+				__m256i bad = _mm256_cmpeq_epi32(x, nd);
+				x = _mm256_andnot_si256(bad, x);
+				vs[k] = _mm256_add_epi32(vs[k], x);
+				vb[k] = _mm256_sub_epi32(vb[k], bad);
+				ve[k] = _mm256_add_epi64(ve[k], _mm256_mul_epi32(x, x));
+				x = _mm256_srli_epi64(x, 32);
+				vo[k] = _mm256_add_epi64(vo[k], _mm256_mul_epi32(x, x));
+				q += 8;
+			}
+		}
+		for(k=0; k<per; k++){
+			_mm256_storeu_si256((__m256i *)s32, vs[k]);
+			_mm256_storeu_si256((__m256i *)b32, vb[k]);
+			for(l=0; l<8; l++){
+				sum[(8*k+l)%nband] += s32[l];
+				cnt[(8*k+l)%nband] += it - start - b32[l];
+			}
+		}
+	}
+	for(k=0; k<per; k++){
+		_mm256_storeu_si256((__m256i *)q64, ve[k]);
+		for(l=0; l<4; l++){
+			sumsq[(8*k+2*l)%nband] += q64[l];
+		}
+		_mm256_storeu_si256((__m256i *)q64, vo[k]);
+		for(l=0; l<4; l++){
+			sumsq[(8*k+2*l+1)%nband] += q64[l];
+		}
+	}
+	kern_stats_scalar(q, npix - nit*8*per/nband, nband, nodata, cnt, sum, sumsq);
+}
+
+// 16 lanes
+static inline __attribute__((always_inline, target("avx512f")))
+void stats_avx512(const short *p, long npix, int nband, int nodata, long long *cnt, long long *sum, long long *sumsq)
+{
+	int per = kern_period(nband, 16);
+	long nit = npix*nband / (16*per);
+	const short *q = p;
+	const __m512i nd = _mm512_set1_epi32(nodata);
+	__m512i vs[KERN_MAX_BAND], vb[KERN_MAX_BAND], ve[KERN_MAX_BAND], vo[KERN_MAX_BAND];
+	int s32[16], b32[16];
+	long long q64[8];
+	long it = 0, start;
+	int k, l;
+
+	for(k=0; k<per; k++){
+		ve[k] = _mm512_setzero_si512();
+		vo[k] = _mm512_setzero_si512();
+	}
+	while(it < nit){
+		start = it;
+		for(k=0; k<per; k++){
+			vs[k] = _mm512_setzero_si512();
+			vb[k] = _mm512_setzero_si512();
+		}
+		for(; it<nit && it-start<KERN_FLUSH; it++){
+			for(k=0; k<per; k++){
+				__m512i x = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *)q));
+				__mmask16 bad = _mm512_cmpeq_epi32_mask(x, nd);
+				x = _mm512_maskz_mov_epi32(~bad, x);
+				vs[k] = _mm512_add_epi32(vs[k], x);
+				vb[k] = _mm512_mask_add_epi32(vb[k], bad, vb[k], _mm512_set1_epi32(1));
+				ve[k] = _mm512_add_epi64(ve[k], _mm512_mul_epi32(x, x));
+				x = _mm512_srli_epi64(x, 32);
+				vo[k] = _mm512_add_epi64(vo[k], _mm512_mul_epi32(x, x));
+				q += 16;
+			}
+		}
+		for(k=0; k<per; k++){
+			_mm512_storeu_si512((__m512i *)s32, vs[k]);
+			_mm512_storeu_si512((__m512i *)b32, vb[k]);
+			for(l=0; l<16; l++){
+				sum[(16*k+l)%nband] += s32[l];
+				cnt[(16*k+l)%nband] += it - start - b32[l];
+			}
+		}
+	}
+	for(k=0; k<per; k++){
+		_mm512_storeu_si512((__m512i *)q64, ve[k]);
+		for(l=0; l<8; l++){
+			sumsq[(16*k+2*l)%nband] += q64[l];
+		}
+		_mm512_storeu_si512((__m512i *)q64, vo[k]);
+		for(l=0; l<8; l++){
+			sumsq[(16*k+2*l+1)%nband] += q64[l];
+		}
+	}
+	kern_stats_scalar(q, npix - nit*16*per/nband, nband, nodata, cnt, sum, sumsq);
+}
+
+// specialised entry points: any band count, and constant 1, 2 and 6 bands
+#define KERN_VARIANTS(isa, tgt) \
+static __attribute__((target(tgt))) void isa##_g(const short *p, long npix, int nband, int nodata, long long *cnt, long long *sum, long long *sumsq) \
+{ \
+	if(nband > KERN_MAX_BAND){ \
+		kern_stats_scalar(p, npix, nband, nodata, cnt, sum, sumsq); \
+		return; \
+	} \
+	stats_##isa(p, npix, nband, nodata, cnt, sum, sumsq); \
+} \
+static __attribute__((target(tgt))) void isa##_1(const short *p, long npix, int nband, int nodata, long long *cnt, long long *sum, long long *sumsq) \
+{ \
+	stats_##isa(p, npix, 1, nodata, cnt, sum, sumsq); \
+} \
+static __attribute__((target(tgt))) void isa##_2(const short *p, long npix, int nband, int nodata, long long *cnt, long long *sum, long long *sumsq) \
+{ \
+	stats_##isa(p, npix, 2, nodata, cnt, sum, sumsq); \
+} \
+static __attribute__((target(tgt))) void isa##_6(const short *p, long npix, int nband, int nodata, long long *cnt, long long *sum, long long *sumsq) \
+{ \
+	stats_##isa(p, npix, 6, nodata, cnt, sum, sumsq); \
+}
+
+KERN_VARIANTS(sse42, "sse4.2")
+KERN_VARIANTS(avx2, "avx2")
+KERN_VARIANTS(avx512, "avx512f")
+
+#endif
+
+typedef struct{
+	char *name;
+	KERN_FN g;
+	KERN_FN b1;
+	KERN_FN b2;
+	KERN_FN b6;
+	void (*bswap)(void *dst, const void *src, size_t n, int dsize);
+}KERN_SET;
+
+// in order of preference, best last
+static KERN_SET kset[] = {
+	{"scalar", kern_stats_scalar, kern_stats_scalar, kern_stats_scalar, kern_stats_scalar, bswap_scalar},
+#ifdef KERN_X86
+	{"sse4.2", sse42_g, sse42_1, sse42_2, sse42_6, bswap_sse42},
+	{"avx2", avx2_g, avx2_1, avx2_2, avx2_6, bswap_avx2},
+	{"avx512", avx512_g, avx512_1, avx512_2, avx512_6, bswap_avx2},
+#endif
+};
+
+static KERN_SET *kcur = &kset[0];
+
+// CPUID feature bits, including OS support of the wider register state
+static int kern_supported(KERN_SET *k)
+{
+#ifdef KERN_X86
+	__builtin_cpu_init();
+	if(strcmp(k->name, "sse4.2") == 0){
+		return __builtin_cpu_supports("sse4.2");
+	}
+	if(strcmp(k->name, "avx2") == 0){
+		return __builtin_cpu_supports("avx2");
+	}
+	if(strcmp(k->name, "avx512") == 0){
+		return __builtin_cpu_supports("avx512f");
+	}
+#endif
+	return strcmp(k->name, "scalar") == 0;
+}
+
+/* Pick the kernels: the best the CPU supports when name is NULL,
+ * otherwise the named set ("scalar", "sse4.2", "avx2", "avx512").
+ */
+int kernel_init(char *name)
+{
+	int n = sizeof(kset) / sizeof(kset[0]);
+	int i;
+
+	for(i=n-1; i>=0; i--){
+		if(name != NULL && strcmp(name, kset[i].name) != 0){
+			continue;
+		}
+		if(kern_supported(&kset[i])){
+			kcur = &kset[i];
+			return 0;
+		}
+		if(name != NULL){
+			break;
+		}
+	}
+	return -1;
+}
+
+char *kernel_name(void)
+{
+	return kcur->name;
+}
+
+void kern_stats(const short *p, long npix, int nband, int nodata, long long *cnt, long long *sum, long long *sumsq)
+{
+	switch(nband){
+	case 1:
+		kcur->b1(p, npix, nband, nodata, cnt, sum, sumsq);
+		break;
+	case 2:
+		kcur->b2(p, npix, nband, nodata, cnt, sum, sumsq);
+		break;
+	case 6:
+		kcur->b6(p, npix, nband, nodata, cnt, sum, sumsq);
+		break;
+	default:
+		kcur->g(p, npix, nband, nodata, cnt, sum, sumsq);
+	}
+}
+
+void kern_bswap(void *dst, const void *src, size_t n, int dsize)
+{
+	kcur->bswap(dst, src, n, dsize);
+}
+
+// nband runs of npix values, bstride values apart: a BIL row or BSQ planes
+void kern_stats_planar(const short *p, long npix, long bstride, int nband, int nodata, long long *cnt, long long *sum, long long *sumsq)
+{
+	int b;
+	for(b=0; b<nband; b++){
+		kcur->b1(p + b*bstride, npix, 1, nodata, &cnt[b], &sum[b], &sumsq[b]);
+	}
+}
+
+/* Typed kernels. 16-bit integers go through the vector kernels above;
+ * 8-bit and unsigned 16-bit sum exactly in 64-bit integers; wider
+ * integers and floats take two passes over the span in double (mean,
+ * then squared deviations), which keeps M2 stable for any value range.
+ * NaN is never a valid float value.
+ */
+#define PIX_INT_KERNELS(T, name) \
+static void int_##name(const T *p, long npix, long step, long long nd, MOMENT *m) \
+{ \
+	long long n = 0, s = 0, q = 0; \
+	long i; \
+	for(i=0; i<npix; i++){ \
+		long long v = p[i*step]; \
+		if(v != nd){ \
+			n++; \
+			s += v; \
+			q += v*v; \
+		} \
+	} \
+	moment_add_sums(m, n, s, q); \
+} \
+static void bip_##name(const void *p, long npix, int nband, long bstride, const NODATA *nd, MOMENT *m) \
+{ \
+	long long v = nd->set ? (long long)nd->value : -1; \
+	int b; \
+	for(b=0; b<nband; b++){ \
+		int_##name((const T *)p + b, npix, nband, v, &m[b]); \
+	} \
+} \
+static void planar_##name(const void *p, long npix, int nband, long bstride, const NODATA *nd, MOMENT *m) \
+{ \
+	long long v = nd->set ? (long long)nd->value : -1; \
+	int b; \
+	for(b=0; b<nband; b++){ \
+		int_##name((const T *)p + b*bstride, npix, 1, v, &m[b]); \
+	} \
+}
+
+#define PIX_FLT_KERNELS(T, name) \
+static void flt_##name(const T *p, long npix, long step, const NODATA *nd, MOMENT *m) \
+{ \
+	int use = nd->set; \
+	T ndv = use ? (T)nd->value : 0; \
+	long n = 0, i; \
+	double s = 0.0, q = 0.0, d; \
+	MOMENT r; \
+	for(i=0; i<npix; i++){ \
+		T v = p[i*step]; \
+		if(v == v && !(use && v == ndv)){ \
+			n++; \
+			s += (double)v; \
+		} \
+	} \
+	if(n == 0){ \
+		return; \
+	} \
+	r.n = n; \
+	r.mean = s / n; \
+	for(i=0; i<npix; i++){ \
+		T v = p[i*step]; \
+		if(v == v && !(use && v == ndv)){ \
+			d = (double)v - r.mean; \
+			q += d*d; \
+		} \
+	} \
+	r.m2 = q; \
+	moment_merge(m, &r); \
+} \
+static void bip_##name(const void *p, long npix, int nband, long bstride, const NODATA *nd, MOMENT *m) \
+{ \
+	int b; \
+	for(b=0; b<nband; b++){ \
+		flt_##name((const T *)p + b, npix, nband, nd, &m[b]); \
+	} \
+} \
+static void planar_##name(const void *p, long npix, int nband, long bstride, const NODATA *nd, MOMENT *m) \
+{ \
+	int b; \
+	for(b=0; b<nband; b++){ \
+		flt_##name((const T *)p + b*bstride, npix, 1, nd, &m[b]); \
+	} \
+}
+
+PIX_INT_KERNELS(unsigned char, uint8)
+PIX_INT_KERNELS(unsigned short, uint16)
+PIX_FLT_KERNELS(int, int32)
+PIX_FLT_KERNELS(unsigned int, uint32)
+PIX_FLT_KERNELS(long long, int64)
+PIX_FLT_KERNELS(unsigned long long, uint64)
+PIX_FLT_KERNELS(float, float32)
+PIX_FLT_KERNELS(double, float64)
+
+static void int16_sums(MOMENT *m, int nband, long long *cnt, long long *sum, long long *sumsq)
+{
+	int b;
+	for(b=0; b<nband; b++){
+		moment_add_sums(&m[b], cnt[b], sum[b], sumsq[b]);
+	}
+}
+
+static void bip_int16(const void *p, long npix, int nband, long bstride, const NODATA *nd, MOMENT *m)
+{
+	long long cnt[nband], sum[nband], sumsq[nband];
+	memset(cnt, 0, sizeof(cnt));
+	memset(sum, 0, sizeof(sum));
+	memset(sumsq, 0, sizeof(sumsq));
+	kern_stats((const short *)p, npix, nband, nd->set ? (int)nd->value : 0x10000, cnt, sum, sumsq);
+	int16_sums(m, nband, cnt, sum, sumsq);
+}
+
+static void planar_int16(const void *p, long npix, int nband, long bstride, const NODATA *nd, MOMENT *m)
+{
+	long long cnt[nband], sum[nband], sumsq[nband];
+	memset(cnt, 0, sizeof(cnt));
+	memset(sum, 0, sizeof(sum));
+	memset(sumsq, 0, sizeof(sumsq));
+	kern_stats_planar((const short *)p, npix, bstride, nband, nd->set ? (int)nd->value : 0x10000, cnt, sum, sumsq);
+	int16_sums(m, nband, cnt, sum, sumsq);
+}
+
+static struct{
+	int dtype;
+	double lo;		// range of an integer type, lo <= nodata < hi
+	double hi;
+	PIX_FN bip;
+	PIX_FN planar;
+}ptype[] = {
+	{1, 0, 256, bip_uint8, planar_uint8},
+	{2, -32768, 32768, bip_int16, planar_int16},
+	{3, -0x1p31, 0x1p31, bip_int32, planar_int32},
+	{4, -HUGE_VAL, HUGE_VAL, bip_float32, planar_float32},
+	{5, -HUGE_VAL, HUGE_VAL, bip_float64, planar_float64},
+	{12, 0, 65536, bip_uint16, planar_uint16},
+	{13, 0, 0x1p32, bip_uint32, planar_uint32},
+	{14, -0x1p63, 0x1p63, bip_int64, planar_int64},
+	{15, 0, 0x1p64, bip_uint64, planar_uint64},
+};
+
+#define NPTYPE ((int)(sizeof(ptype) / sizeof(ptype[0])))
+
+// kernel for a data type and interleave, NULL if the type is not supported
+PIX_FN kern_select(int dtype, int il)
+{
+	int i;
+	for(i=0; i<NPTYPE; i++){
+		if(ptype[i].dtype == dtype){
+			return il == ENVI_BIP ? ptype[i].bip : ptype[i].planar;
+		}
+	}
+	return NULL;
+}
+
+/* N2B kernels. Pixels go N2B_CHUNK at a time: the broadband values are
+ * built band by band over the chunk, a multiply-add per value with unit
+ * stride in BIL and BSQ rows, so the loops vectorize; a pixel with
+ * nodata or NaN in any band is dropped. Mean and M2 of the chunk take two
+ * passes over the values, as the float kernels.
+ */
+#define N2B_CHUNK (256)
+
+#define N2B_KERNELS(T, name) \
+static void n2b_##name(const T *p, long npix, int nband, long ps, long bs, const NODATA *nd, const double *coef, MOMENT *m) \
+{ \
+	int use = nd->set; \
+	T ndv = use ? (T)nd->value : 0; \
+	double y[N2B_CHUNK], d, q; \
+	unsigned char ok[N2B_CHUNK]; \
+	long i, i0, n, len; \
+	int b; \
+	MOMENT r; \
+	for(i0=0; i0<npix; i0+=N2B_CHUNK){ \
+		len = npix - i0 < N2B_CHUNK ? npix - i0 : N2B_CHUNK; \
+		for(i=0; i<len; i++){ \
+			y[i] = coef[nband]; \
+			ok[i] = 1; \
+		} \
+		for(b=0; b<nband; b++){ \
+			const T *v = p + i0*ps + b*bs; \
+			double c = coef[b]; \
+			for(i=0; i<len; i++){ \
+				T x = v[i*ps]; \
+				ok[i] &= x == x && !(use && x == ndv); \
+				y[i] += c * (double)x; \
+			} \
+		} \
+		for(n=0, d=0.0, i=0; i<len; i++){ \
+			n += ok[i]; \
+			d += ok[i] ? y[i] : 0.0; \
+		} \
+		if(n == 0){ \
+			continue; \
+		} \
+		r.n = n; \
+		r.mean = d / n; \
+		for(q=0.0, i=0; i<len; i++){ \
+			d = y[i] - r.mean; \
+			q += ok[i] ? d*d : 0.0; \
+		} \
+		r.m2 = q; \
+		moment_merge(m, &r); \
+	} \
+} \
+static void n2b_bip_##name(const void *p, long npix, int nband, long bstride, const NODATA *nd, const double *coef, MOMENT *m) \
+{ \
+	n2b_##name((const T *)p, npix, nband, nband, 1, nd, coef, m); \
+} \
+static void n2b_planar_##name(const void *p, long npix, int nband, long bstride, const NODATA *nd, const double *coef, MOMENT *m) \
+{ \
+	n2b_##name((const T *)p, npix, nband, 1, bstride, nd, coef, m); \
+}
+
+N2B_KERNELS(unsigned char, uint8)
+N2B_KERNELS(short, int16)
+N2B_KERNELS(unsigned short, uint16)
+N2B_KERNELS(int, int32)
+N2B_KERNELS(unsigned int, uint32)
+N2B_KERNELS(long long, int64)
+N2B_KERNELS(unsigned long long, uint64)
+N2B_KERNELS(float, float32)
+N2B_KERNELS(double, float64)
+
+static struct{
+	int dtype;
+	N2B_FN bip;
+	N2B_FN planar;
+}ntype[] = {
+	{1, n2b_bip_uint8, n2b_planar_uint8},
+	{2, n2b_bip_int16, n2b_planar_int16},
+	{3, n2b_bip_int32, n2b_planar_int32},
+	{4, n2b_bip_float32, n2b_planar_float32},
+	{5, n2b_bip_float64, n2b_planar_float64},
+	{12, n2b_bip_uint16, n2b_planar_uint16},
+	{13, n2b_bip_uint32, n2b_planar_uint32},
+	{14, n2b_bip_int64, n2b_planar_int64},
+	{15, n2b_bip_uint64, n2b_planar_uint64},
+};
+
+// N2B kernel for a data type and interleave, NULL if the type is not supported
+N2B_FN kern_n2b_select(int dtype, int il)
+{
+	int i;
+	for(i=0; i<(int)(sizeof(ntype) / sizeof(ntype[0])); i++){
+		if(ntype[i].dtype == dtype){
+			return il == ENVI_BIP ? ntype[i].bip : ntype[i].planar;
+		}
+	}
+	return NULL;
+}
+
+/* Weighted kernels: weight, weighted sum, then weighted squared
+ * deviations from the run mean, each a plain loop over the run.
+ */
+#define WPIX_KERNELS(T, name) \
+static void wpix_##name(const T *p, long npix, long step, const NODATA *nd, const double *wt, WMOMENT *m) \
+{ \
+	int use = nd->set; \
+	T ndv = use ? (T)nd->value : 0; \
+	double w = 0.0, s = 0.0, q = 0.0, d; \
+	long n = 0, i; \
+	WMOMENT r; \
+	for(i=0; i<npix; i++){ \
+		T v = p[i*step]; \
+		int ok = v == v && !(use && v == ndv); \
+		w += ok ? wt[i] : 0.0; \
+		s += ok ? wt[i] * (double)v : 0.0; \
+		n += ok && wt[i] > 0.0; \
+	} \
+	if(w <= 0.0){ \
+		return; \
+	} \
+	r.w = w; \
+	r.mean = s / w; \
+	for(i=0; i<npix; i++){ \
+		T v = p[i*step]; \
+		d = (double)v - r.mean; \
+		q += v == v && !(use && v == ndv) ? wt[i] * d*d : 0.0; \
+	} \
+	r.m2 = q; \
+	r.n = n; \
+	wmoment_merge(m, &r); \
+} \
+static void wpix_bip_##name(const void *p, long npix, int nband, long bstride, const NODATA *nd, const double *wt, WMOMENT *m) \
+{ \
+	int b; \
+	for(b=0; b<nband; b++){ \
+		wpix_##name((const T *)p + b, npix, nband, nd, wt, &m[b]); \
+	} \
+} \
+static void wpix_planar_##name(const void *p, long npix, int nband, long bstride, const NODATA *nd, const double *wt, WMOMENT *m) \
+{ \
+	int b; \
+	for(b=0; b<nband; b++){ \
+		wpix_##name((const T *)p + b*bstride, npix, 1, nd, wt, &m[b]); \
+	} \
+}
+
+WPIX_KERNELS(unsigned char, uint8)
+WPIX_KERNELS(short, int16)
+WPIX_KERNELS(unsigned short, uint16)
+WPIX_KERNELS(int, int32)
+WPIX_KERNELS(unsigned int, uint32)
+WPIX_KERNELS(long long, int64)
+WPIX_KERNELS(unsigned long long, uint64)
+WPIX_KERNELS(float, float32)
+WPIX_KERNELS(double, float64)
+
+static struct{
+	int dtype;
+	WPIX_FN bip;
+	WPIX_FN planar;
+}wtype[] = {
+	{1, wpix_bip_uint8, wpix_planar_uint8},
+	{2, wpix_bip_int16, wpix_planar_int16},
+	{3, wpix_bip_int32, wpix_planar_int32},
+	{4, wpix_bip_float32, wpix_planar_float32},
+	{5, wpix_bip_float64, wpix_planar_float64},
+	{12, wpix_bip_uint16, wpix_planar_uint16},
+	{13, wpix_bip_uint32, wpix_planar_uint32},
+	{14, wpix_bip_int64, wpix_planar_int64},
+	{15, wpix_bip_uint64, wpix_planar_uint64},
+};
+
+// weighted kernel for a data type and interleave, NULL if the type is not supported
+WPIX_FN kern_wselect(int dtype, int il)
+{
+	int i;
+	for(i=0; i<(int)(sizeof(wtype) / sizeof(wtype[0])); i++){
+		if(wtype[i].dtype == dtype){
+			return il == ENVI_BIP ? wtype[i].bip : wtype[i].planar;
+		}
+	}
+	return NULL;
+}
+
+/* A nodata the type can not hold, or a fractional one for an integer type,
+ * masks nothing. The integer bounds are exclusive above: 2^63 and 2^64
+ * are the nearest doubles to the largest 64-bit values and must not pass.
+ */
+void kern_nodata(int dtype, int has, double value, NODATA *nd)
+{
+	int i;
+
+	nd->set = 0;
+	nd->value = value;
+	if(!has || value != value){
+		return;
+	}
+	for(i=0; i<NPTYPE; i++){
+		if(ptype[i].dtype != dtype){
+			continue;
+		}
+		if(dtype == 4){
+			nd->set = (double)(float)value == value;
+		}
+		else if(dtype == 5){
+			nd->set = 1;
+		}
+		else{
+			nd->set = value >= ptype[i].lo && value < ptype[i].hi && floor(value) == value;
+		}
+	}
+}
+
+// xorshift, for the check rows
+static unsigned long long check_next(unsigned long long *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+/* n random values of a data type into buf, about one in eight the nodata
+ * 7; 16-bit values span the whole type, so its ends come up too.
+ */
+static void check_fill(void *buf, int dtype, long n, unsigned long long *s)
+{
+	long i;
+
+	for(i=0; i<n; i++){
+		unsigned long long r = check_next(s);
+		double f = (double)(long long)(r >> 11) / (1LL << 40) - 2048.0;
+		if(r % 8 == 0){
+			r = 7;
+			f = 7.0;
+		}
+		switch(dtype){
+		case 1:
+			((unsigned char *)buf)[i] = (unsigned char)r;
+			break;
+		case 2:
+			((short *)buf)[i] = (short)(unsigned short)r;
+			break;
+		case 3:
+			((int *)buf)[i] = (int)(unsigned int)r;
+			break;
+		case 4:
+			((float *)buf)[i] = (float)f;
+			break;
+		case 5:
+			((double *)buf)[i] = f;
+			break;
+		case 12:
+			((unsigned short *)buf)[i] = (unsigned short)r;
+			break;
+		case 13:
+			((unsigned int *)buf)[i] = (unsigned int)r;
+			break;
+		case 14:
+			((long long *)buf)[i] = (long long)(r >> 1) - (1LL << 62);
+			break;
+		case 15:
+			((unsigned long long *)buf)[i] = r;
+			break;
+		}
+	}
+}
+
+static int check_same(const MOMENT *a, const MOMENT *b, int nband)
+{
+	int i;
+
+	for(i=0; i<nband; i++){
+		if(a[i].n != b[i].n || a[i].mean != b[i].mean || a[i].m2 != b[i].m2){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Check each vector kernel set the CPU supports against the scalar set.
+ * Every data type, in BIP and in band runs, takes random rows of 1 to 17
+ * bands, unaligned, with and without nodata, of lengths that leave a
+ * partial vector at the end and of one long enough to flush the 32-bit
+ * lane sums; the moments must be identical. Unaligned byte swaps of any
+ * number of values, in place, must give the same bytes. Mismatches are reported on stderr; returns
+ * their number.
+ */
+int kernel_check(void)
+{
+	static const int nbands[] = {1, 2, 3, 6, 7, 16, 17};
+	static const long npixs[] = {1, 7, 61, 1023, 600001};
+	KERN_SET *save = kcur;
+	MOMENT m0[17], m1[17];
+	unsigned long long seed = 88172645463325252ULL;
+	int nset = sizeof(kset) / sizeof(kset[0]);
+	int nbad = 0, nchecked = 0;
+	int s, t, il, i, j, h, b;
+
+	for(s=1; s<nset; s++){
+		if(!kern_supported(&kset[s])){
+			continue;
+		}
+		nchecked++;
+		for(t=0; t<NPTYPE; t++){
+			int ds = envi_dsize(ptype[t].dtype);
+			for(il=ENVI_BIL; il<=ENVI_BIP; il++){
+				for(i=0; i<(int)(sizeof(nbands) / sizeof(nbands[0])); i++){
+					for(j=0; j<(int)(sizeof(npixs) / sizeof(npixs[0])); j++){
+						int nband = nbands[i];
+						long npix = npixs[j];
+						long bstride = npix + 3;
+						char *buf;
+						if(npix > 10000 && nband > 2){
+							continue;
+						}
+						buf = (char *)malloc(((long)nband*bstride + 1)*ds);
+						if(buf == NULL){
+							kcur = save;
+							return nbad + 1;
+						}
+						check_fill(buf, ptype[t].dtype, (long)nband*bstride + 1, &seed);
+						for(h=0; h<2; h++){
+							NODATA nd;
+							kern_nodata(ptype[t].dtype, h, 7.0, &nd);
+							for(b=0; b<nband; b++){
+								moment_init(&m0[b]);
+								moment_init(&m1[b]);
+							}
+							kcur = &kset[0];
+							kern_select(ptype[t].dtype, il)(buf + ds, npix, nband, bstride, &nd, m0);
+							kcur = &kset[s];
+							kern_select(ptype[t].dtype, il)(buf + ds, npix, nband, bstride, &nd, m1);
+							if(!check_same(m0, m1, nband)){
+								fprintf(stderr, "KERNEL %s DIFFERS FROM SCALAR. type %d, %s, %d bands, %ld pixels, %s\n",
+										kset[s].name, ptype[t].dtype, il == ENVI_BIP ? "bip" : "planar", nband, npix, h ? "nodata 7" : "no nodata");
+								nbad++;
+							}
+						}
+						free(buf);
+					}
+				}
+			}
+		}
+		for(i=2; i<=8; i*=2){
+			unsigned char src[1031], d0[1031], d1[1031];
+			for(j=0; j<(int)sizeof(src); j++){
+				src[j] = (unsigned char)check_next(&seed);
+			}
+			for(j=0; (j+1)*i<(int)sizeof(src); j+=j<40 ? 1 : 13){
+				bswap_scalar(d0, src + 1, j*i, i);
+				memcpy(d1, src + 1, j*i);
+				kset[s].bswap(d1, d1, j*i, i);
+				if(0 != memcmp(d0, d1, j*i)){
+					fprintf(stderr, "BYTE SWAP %s DIFFERS FROM SCALAR. %d-byte values, %d bytes\n", kset[s].name, i, j*i);
+					nbad++;
+				}
+			}
+		}
+	}
+	kcur = save;
+	fprintf(stderr, "Kernel sets checked against scalar = %d, mismatches = %d\n", nchecked, nbad);
+	return nbad;
+}
@@ -0,0 +1,65 @@
+#ifndef __INC_KERNEL_H
+#define __INC_KERNEL_H
+
+#include <stddef.h>
+#include "stats.h"
+
+/* Masked window statistics of 16-bit pixels: for each band add the count,
+ * sum and sum of squares of the values that are not nodata to cnt, sum and
+ * sumsq. p points to npix pixels of nband interleaved values (a BIP row
+ * span); a BIL or BSQ band run is the nband 1 case. A nodata outside the
+ * 16-bit range masks nothing.
+ */
+typedef void (*KERN_FN)(const short *p, long npix, int nband, int nodata, long long *cnt, long long *sum, long long *sumsq);
+
+// instruction set picked at startup, or forced by name
+int kernel_init(char *name);
+char *kernel_name(void);
+
+void kern_stats(const short *p, long npix, int nband, int nodata, long long *cnt, long long *sum, long long *sumsq);
+void kern_stats_planar(const short *p, long npix, long bstride, int nband, int nodata, long long *cnt, long long *sum, long long *sumsq);
+
+/* Reverse the byte order of n bytes of dsize-byte values while copying
+ * src to dst; dst may be src. Other sizes are copied unchanged.
+ */
+void kern_bswap(void *dst, const void *src, size_t n, int dsize);
+
+// reference implementation the vector kernels are checked against
+void kern_stats_scalar(const short *p, long npix, int nband, int nodata, long long *cnt, long long *sum, long long *sumsq);
+
+/* Run every vector kernel set the CPU supports against the scalar one on
+ * random rows of each data type and interleave; returns the mismatches.
+ */
+int kernel_check(void);
+
+/* Window statistics of any ENVI data type, merged into the per-band
+ * moments m. p is a BIP span of npix pixels, or band runs bstride values
+ * apart for BIL and BSQ. One function per data type and interleave is
+ * picked per file with kern_select, so no type test runs per pixel.
+ */
+typedef struct{
+	int set;		// the file has a nodata value, representable in its type
+	double value;
+}NODATA;
+
+typedef void (*PIX_FN)(const void *p, long npix, int nband, long bstride, const NODATA *nd, MOMENT *m);
+
+PIX_FN kern_select(int dtype, int il);
+void kern_nodata(int dtype, int has, double value, NODATA *nd);
+
+/* Narrow-to-broadband conversion fused with the statistics: for each
+ * pixel valid in every band, coef[0..nband-1] dotted with its values plus
+ * coef[nband], merged into the one moment m. Same layout of p as PIX_FN.
+ */
+typedef void (*N2B_FN)(const void *p, long npix, int nband, long bstride, const NODATA *nd, const double *coef, MOMENT *m);
+
+N2B_FN kern_n2b_select(int dtype, int il);
+
+/* Weighted window statistics: value i of a run counts wt[i], its area
+ * inside the footprint. Same layout of p as PIX_FN, one weight per pixel.
+ */
+typedef void (*WPIX_FN)(const void *p, long npix, int nband, long bstride, const NODATA *nd, const double *wt, WMOMENT *m);
+
+WPIX_FN kern_wselect(int dtype, int il);
+
+#endif
@@ -1,27 +1,689 @@
 #include <stdio.h>
-#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <ctype.h>
+#include <unistd.h>
 #include "hdf.h"
 #include "mfhdf.h"
 #include "proj.h"
 
 #include "envi.h"
 #include "space.h"
+#include "batch.h"
+#include "site.h"
+#include "raster.h"
+#include "stats.h"
+#include "kernel.h"
+#include "footprint.h"
+#include "sat.h"
+#include "zonemap.h"
+#include "overview.h"
+#include "scl.h"
+#include "n2b.h"
+#include "dist.h"
+#include "polygon.h"
+#include "geoloc.h"
+#include "warp.h"
 
-int main(int argc, char *argv[])
+// rows fetched per batch of reads in a sweep
+#define ROW_BLOCK (64)
+
+// footprint sizes per site in one sweep
+#define MAX_FOOTPRINT (16)
+
+// albedo products without "data ignore value" or a gain or scale factor in the header
+#define ALBEDO_FILL (32767)
+#define ALBEDO_SCALE (10000.0)
+
+static void usage(void)
+{
+        printf("Usage:\n");
+        printf("  sub <envi.bin> <lat> <lon> <window> <year> <doy> <tile> <sensor> <base>\n");
+        printf("  sub --lat=<lat> --lon=<lon> -w <window[,...]> -d <directory|file list> [-p <pattern>] [-o <output csv>]\n");
+        printf("  sub --lat=<lat> --lon=<lon> -D <diameter[,...]> -d <directory|file list> [-p <pattern>] [-o <output csv>]\n");
+        printf("  sub -s <site csv> [-w|-D <size[,...]>] -d <directory|file list> [-p <pattern>] [-o <output csv>]\n");
+        printf("  sub --polygons=<file> -d <directory|file list> [-p <pattern>] [-o <output csv>]\n");
+        printf("  sub --geoloc=<envi.bin> -o <output.bin> [--lat=<lat> --lon=<lon> -w <window[,...]>]\n");
+        printf("      [--threads=<n>] [--max-error=<metres>]\n");
+        printf("  batch options:\n");
+        printf("    --pread          read footprint spans with preadv instead of mapping the images\n");
+        printf("    --build-sat      write a summed-area table sidecar <image>.sat for each image\n");
+        printf("                     and exit; windows of an image with a current sidecar are\n");
+        printf("                     answered from it without reading pixels\n");
+        printf("    --raw            ignore the sidecars and read the pixels\n");
+        printf("    --zonemap        use per-block statistics from <image>.zmi, built as windows\n");
+        printf("                     first read blocks whole; all-fill blocks are skipped and\n");
+        printf("                     blocks inside a footprint answered without reading. The\n");
+        printf("                     file is only read, blocks built last for the run\n");
+        printf("    --zonemap-save   --zonemap, and write the blocks built to <image>.zmi,\n");
+        printf("                     creating it next to the image\n");
+        printf("    --build-overview write an overview pyramid <image>.ovr of 8x8.. pixel cell\n");
+        printf("                     moments for each image and exit\n");
+        printf("    --overview       answer the cells of the pyramid that fit inside a footprint\n");
+        printf("                     from it and read only the pixels of the edge; without it,\n");
+        printf("                     or for an image without a current pyramid, every pixel is read\n");
+        printf("    --scl=<pattern>  screen with the SCL image matching the pattern next to each\n");
+        printf("                     image, e.g. \"../R20m/*_SCL_20m.bin\", on a coarser grid\n");
+        printf("                     by index; adds snow free and snow statistics and the\n");
+        printf("                     pixel count of each class, and reads every pixel\n");
+        printf("    --n2b            with --scl, also the shortwave broadband of each window,\n");
+        printf("                     converted per pixel with the coefficients of its SCL\n");
+        printf("                     class, built in for bands 02 03 04 8A 11 12 snow free\n");
+        printf("                     and snow\n");
+        printf("    --n2b-table=<file>  --n2b with the coefficients of a table file, lines of\n");
+        printf("                     \"<class> <weight per band...> <constant>\", class one of\n");
+        printf("                     snow_free, snow, cloud or nodata\n");
+        printf("    --quantiles      also P5, P25, median, P75 and P95 of each band, exact for 8-\n");
+        printf("                     and 16-bit images and within 0.5%% for others; reads every\n");
+        printf("                     pixel\n");
+        printf("    --hist=<lo>,<hi>,<nbin>  --quantiles and a histogram of each band, nbin bins\n");
+        printf("                     over lo..hi in reflectance, the end bins taking the rest\n");
+        printf("    --area           weight each pixel by its overlap with the exact square or\n");
+        printf("                     circle at the site position instead of taking whole pixels;\n");
+        printf("                     count is then the pixels overlapped; reads every pixel\n");
+        printf("    --warp=<metres>  resample each image onto a grid of cells of that size centred\n");
+        printf("                     on the site, a transverse Mercator through it, nearest\n");
+        printf("                     neighbour, and take the footprints there, so images of any\n");
+        printf("                     zone or grid cover the same ground; count is then the cells\n");
+        printf("    --kernel=<name>  statistics kernel: scalar, sse4.2, avx2 or avx512, default the best\n");
+        printf("                     the CPU supports; scalar is the reference for verification\n");
+        printf("    --check-kernels  compare every vector kernel the CPU supports with scalar on\n");
+        printf("                     random rows of each data type and interleave, and exit\n");
+        printf("    --gctp           project WGS-84 UTM through GCTP as the reference instead of\n");
+        printf("                     the native vectorized transform, which agrees to under 1 mm\n");
+        printf("    --check-utm      compare the native UTM transform with GCTP both ways over\n");
+        printf("                     every latitude of several zones out to their edges, and exit\n\n");
+        printf("  The batch forms subset every file under the directory (or listed in\n");
+        printf("  the file list) whose name matches the pattern, default \"S2*albedo*.bin\",\n");
+        printf("  and write one CSV with the acquisition date from the SAFE folder name.\n");
+        printf("  All images must have the same number of bands; the columns of each band\n");
+        printf("  are named by the band names of the first header, or without them BSA and\n");
+        printf("  WSA for bands 1 and 2 and B3, B4.. for the others.\n");
+        printf("  The site csv has lines of id,lat,lon,window[,square|circle]; each image is\n");
+        printf("  read once for all sites inside it and gives one output row per site.\n");
+        printf("  A circle (-D, or \"circle\" in the site csv) takes the pixels whose centre\n");
+        printf("  is within the diameter of the site.\n");
+        printf("  A list of sizes, e.g. -D 30,60,90,250,500, replaces the site windows and\n");
+        printf("  gives one output row per footprint, all from one read of the largest.\n");
+        printf("  The polygon file is GeoJSON of Polygon or MultiPolygon features in\n");
+        printf("  lon/lat, named by the feature id or an id, name or Site_ID property,\n");
+        printf("  or lines of id,WKT with a POLYGON or MULTIPOLYGON; each polygon takes\n");
+        printf("  the pixels whose centre is inside it, holes excluded, and its row has\n");
+        printf("  the lat/lon of its centroid.\n");
+        printf("  --geoloc writes the latitude and longitude of every pixel centre of the\n");
+        printf("  image, or of the window at the site (the largest of a -w list), as a two\n");
+        printf("  band float64 ENVI image, in tiles over --threads threads, default one per\n");
+        printf("  CPU. On a UTM grid, --max-error interpolates each tile from the exact\n");
+        printf("  transform on the coarsest grid within that error, e.g. 0.001 for 1 mm;\n");
+        printf("  without it every pixel is transformed.\n");
+        printf("  Images may be on a UTM, Geographic Lat/Lon, Sinusoidal, Polar Stereographic\n");
+        printf("  or Albers Conical Equal Area grid, from the header map info and projection\n");
+        printf("  info. Window sizes are in metres, on a geographic grid converted by the\n");
+        printf("  ground size of the rows and of the columns at the site.\n");
+        printf("  Values are converted to reflectance as gain * value + offset per band,\n");
+        printf("  ENVI's data gain values and data offset values, or without gain values\n");
+        printf("  1 / the reflectance scale factor, default 1 / 10000 for integer data and\n");
+        printf("  1 for float32 and float64. Statistics of a footprint without valid\n");
+        printf("  pixels are written as the fill value, the data ignore value or 32767.\n");
+}
+
+// value of option -x/--xxx given as "-xV", "-x V", "--xxx=V" or "--xxx V"
+static char *opt_value(int argc, char *argv[], int *i, char *sopt, char *lopt)
+{
+        char *a = argv[*i];
+        int n;
+
+        if(sopt != NULL && strncmp(a, sopt, 2) == 0){
+                if(a[2] != '\0'){
+                        return a+2;
+                }
+        }
+        else{
+                n = strlen(lopt);
+                if(strncmp(a, lopt, n) != 0){
+                        return NULL;
+                }
+                if(a[n] == '='){
+                        return a+n+1;
+                }
+                if(a[n] != '\0'){
+                        return NULL;
+                }
+        }
+        if(*i+1 >= argc){
+                return NULL;
+        }
+        (*i)++;
+        return argv[*i];
+}
+
+/* A site window: the pixel (row, col) holding the site, the run tables
+ * of its nested footprints, smallest first, and the bounding rows and
+ * columns r1..r2, c1..c2 of the largest. mom holds nband moments per
+ * footprint. With a zone map or an overview, skip flags per footprint
+ * the cell x cell blocks by0.., bx0.. under the window that are answered
+ * without pixels. With SCL screening, cls holds the classes of SCL rows
+ * s1.., columns t1.. (nt per row) under the window; smom two moments per
+ * footprint and band, snow free and snow, ncls the class counts and
+ * bmom the broadband moment per footprint and class. With quantiles,
+ * dist holds a distribution per footprint ring and band while the sweep
+ * is inside the window, and qv and hv get the quantiles and histograms.
+ * Area footprints accumulate into wmom, one per footprint and band, each
+ * footprint whole rather than as rings. A polygon site has its row spans
+ * in poly instead of footprints, as one footprint of rows r1..r2. A
+ * warped site has the lookup table of its footprints on its own grid in
+ * warp instead, r1..c2 bounding the source pixels it samples.
+ */
+typedef struct{
+        SITE *site;
+        const FOOTPRINT *fp[MAX_FOOTPRINT];
+        int nfp;
+        int row;
+        int col;
+        int r1;
+        int r2;
+        int c1;
+        int c2;
+        MOMENT *mom;
+        unsigned char *skip;
+        int cell;
+        int by0;
+        int bx0;
+        int nby;
+        int nbx;
+        unsigned char *cls;
+        int s1;
+        int t1;
+        int nt;
+        MOMENT *smom;
+        long long *ncls;
+        MOMENT *bmom;
+        DIST *dist;
+        double *qv;
+        long long *hv;
+        WMOMENT *wmom;
+        POLY_SPANS *poly;
+        const WARP_LUT *warp;
+}SUBSET;
+
+// settings and totals shared by all images of a run
+typedef struct{
+        SITE *sites;
+        int nsite;
+        int multi;              // site list mode
+        int use_map;            // map the images instead of reading spans
+        int use_sat;            // answer from summed-area table sidecars when current
+        int build_sat;          // write the sidecars instead of subsetting
+        int nsat;               // images answered from their sidecar
+        int use_zmap;           // skip or answer blocks from zone maps, built as read whole
+        int save_zmap;          // write the zone maps back to <image>.zmi
+        long long nblock;       // zone map blocks built
+        int use_ovr;            // answer inner cells from overview pyramids
+        int build_ovr;          // write the pyramids instead of subsetting
+        int novr;               // images answered partly from their pyramid
+        char *scl;              // pattern of the SCL image of each image, NULL to not screen
+        int use_n2b;            // broadband per pixel with the coefficients of its class
+        N2B n2b;
+        int area;               // pixels weighted by their overlap with the footprint
+        int use_dist;           // quantiles and histograms per band
+        int nhist;
+        double hlo;             // histogram range, reflectance
+        double hhi;
+        int fpsize[MAX_FOOTPRINT];      // footprint list replacing the site windows
+        int nfp;                        // 0 to use the site windows
+        int fpshape;
+        FP_CACHE fpc;           // footprint run tables, kept across images
+        POLYGON *poly;          // polygon of each site, NULL for footprints
+        double warp;            // cell of the site-centred grid, metres, 0 to use the image grid
+        WARP_CACHE wpc;         // warp lookup tables, kept across images
+        FILE *out;
+        IO_STAT io;
+}RUN;
+
+static int cmp_int(const void *a, const void *b)
+{
+        return *(const int *)a - *(const int *)b;
+}
+
+/* Footprint sizes "30,60,90" into the run, ascending and distinct so
+ * each footprint nests in the next.
+ */
+static int parse_sizes(RUN *run, char *v, int shape)
+{
+        char *end;
+        int i, n = 0;
+
+        while(*v != '\0'){
+                long x = strtol(v, &end, 10);
+                if(end == v || x <= 0 || n == MAX_FOOTPRINT || (*end != ',' && *end != '\0')){
+                        return -1;
+                }
+                run->fpsize[n++] = (int)x;
+                v = *end == ',' ? end+1 : end;
+        }
+        if(n == 0){
+                return -1;
+        }
+        qsort(run->fpsize, n, sizeof(int), cmp_int);
+        for(run->nfp=1, i=1; i<n; i++){
+                if(run->fpsize[i] != run->fpsize[run->nfp-1]){
+                        run->fpsize[run->nfp++] = run->fpsize[i];
+                }
+        }
+        run->fpshape = shape;
+        return 0;
+}
+
+static int cmp_subset_row(const void *a, const void *b)
+{
+        const SUBSET *x = *(SUBSET * const *)a;
+        const SUBSET *y = *(SUBSET * const *)b;
+        return x->r1 - y->r1;
+}
+
+// columns cs..ce of footprint k of window w in row r, 0 if it has none there
+static int window_run(const SUBSET *w, int k, int r, int *cs, int *ce)
+{
+        const FOOTPRINT *fp = w->fp[k];
+        int i = r - w->row - fp->r0;
+
+        if(i < 0 || r - w->row > fp->r1){
+                return 0;
+        }
+        *cs = w->col + fp->cs[i];
+        *ce = w->col + fp->ce[i] - 1;
+        return *ce >= *cs;
+}
+
+/* Runs of ring k of window w in row r, the pixels of footprint k outside
+ * footprint k-1: left and right of the inner run, or the whole run.
+ * Fills run with inclusive column pairs and returns their number.
+ */
+static int ring_runs(const SUBSET *w, int k, int r, int *run)
+{
+        int cs, ce, is, ie, n = 0;
+
+        if(!window_run(w, k, r, &cs, &ce)){
+                return 0;
+        }
+        if(k == 0 || !window_run(w, k-1, r, &is, &ie)){
+                is = ie = ce + 1;
+        }
+        if(is > cs){
+                run[2*n] = cs;
+                run[2*n+1] = is <= ce ? is-1 : ce;
+                n++;
+        }
+        if(ie < ce){
+                run[2*n] = ie+1;
+                run[2*n+1] = ce;
+                n++;
+        }
+        return n;
+}
+
+/* Ring runs of window w in row r less the columns of blocks answered
+ * from the zone map or overview, which need no pixels read.
+ */
+static int window_runs(const SUBSET *w, int k, int r, int *run)
+{
+        const unsigned char *skip;
+        int part[4], i, n, nrun = 0;
+
+        if(w->poly != NULL){
+                const POLY_SPANS *ps = w->poly;
+                n = ps->rs[r - ps->r1 + 1] - ps->rs[r - ps->r1];
+                memcpy(run, ps->run + 2*ps->rs[r - ps->r1], 2*n*sizeof(int));
+                return n;
+        }
+        if(w->skip == NULL){
+                return ring_runs(w, k, r, run);
+        }
+        n = ring_runs(w, k, r, part);
+        skip = w->skip + ((long)k*w->nby + r/w->cell - w->by0)*w->nbx - w->bx0;
+        for(i=0; i<n; i++){
+                int c = part[2*i];
+                while(c <= part[2*i+1]){
+                        int ce = (c/w->cell + 1)*w->cell - 1;
+                        if(ce > part[2*i+1]){
+                                ce = part[2*i+1];
+                        }
+                        if(!skip[c/w->cell]){
+                                if(nrun > 0 && run[2*nrun-1] == c-1){
+                                        run[2*nrun-1] = ce;
+                                }
+                                else{
+                                        run[2*nrun] = c;
+                                        run[2*nrun+1] = ce;
+                                        nrun++;
+                                }
+                        }
+                        c = ce + 1;
+                }
+        }
+        return nrun;
+}
+
+// add column interval c1..c2 to the niv intervals of iv, kept sorted by start
+static void iv_insert(int *iv, int *niv, int c1, int c2)
+{
+        int j;
+
+        for(j=*niv; j>0 && iv[2*(j-1)]>c1; j--){
+                iv[2*j] = iv[2*(j-1)];
+                iv[2*j+1] = iv[2*(j-1)+1];
+        }
+        iv[2*j] = c1;
+        iv[2*j+1] = c2;
+        (*niv)++;
+}
+
+// SCL screening of an image in a sweep, and its broadband conversion
+typedef struct{
+        const SCL *scl;
+        N2B_FN n2bfn;           // NULL without broadband
+        N2B n2b;                // coefficients on the stored values
+}SCREEN;
+
+/* Split columns cs..ce of row r of window w by the SCL class of their
+ * pixels: count the classes in ring k and merge the clear and the snow
+ * pixels into their stratum, one kernel call per run of equal class.
+ * Runs of a class with N2B coefficients also go through the broadband
+ * kernel, into the moment of the class.
+ */
+static void strata_run(const SCREEN *scr, SUBSET *w, int k, int r, int cs, int ce, char *row, int il, int dsize, int nband, long bstride, PIX_FN kfn, NODATA *nd)
+{
+        static const int stratum[SCL_NCLASS] = {-1, 0, -1, 1};
+        const SCL *scl = scr->scl;
+        const unsigned char *cls = w->cls + (long)(scl_div(r + scl->oy, scl->f) - w->s1)*w->nt - w->t1;
+        int c = cs;
+
+        while(c <= ce){
+                int t = scl_div(c + scl->ox, scl->f);
+                int cl = cls[t];
+                int e;
+                for(t++; t - w->t1 < w->nt && t*scl->f - scl->ox <= ce && cls[t] == cl; t++);
+                e = t*scl->f - scl->ox - 1;
+                if(e > ce){
+                        e = ce;
+                }
+                w->ncls[k*SCL_NCLASS + cl] += e - c + 1;
+                long off = il == ENVI_BIP ? (long)c*nband : c;
+                if(stratum[cl] >= 0){
+                        kfn(row + off*dsize, e-c+1, nband, bstride, nd, w->smom + ((long)k*2 + stratum[cl])*nband);
+                }
+                if(scr->n2bfn != NULL && scr->n2b.set[cl]){
+                        scr->n2bfn(row + off*dsize, e-c+1, nband, bstride, nd, scr->n2b.coef[cl], &w->bmom[k*SCL_NCLASS + cl]);
+                }
+                c = e + 1;
+        }
+}
+
+/* Distributions of the rings of window w, from the first row the sweep
+ * takes for it, band b with the histogram of ds[b].
+ */
+static int dist_open(SUBSET *w, int nband, const DIST_SPEC *ds)
+{
+        int i;
+
+        w->dist = (DIST *)calloc((long)w->nfp*nband, sizeof(DIST));
+        if(w->dist == NULL){
+                return -1;
+        }
+        for(i=0; i<w->nfp*nband; i++){
+                if(0 != dist_init(&w->dist[i], &ds[i % nband])){
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+static void dist_release(SUBSET *w, int nband)
+{
+        int i;
+
+        if(w->dist == NULL){
+                return;
+        }
+        for(i=0; i<w->nfp*nband; i++){
+                dist_free(&w->dist[i]);
+        }
+        free(w->dist);
+        w->dist = NULL;
+}
+
+/* Past the last row of window w: merge its rings outward into the
+ * footprints, keep their quantiles and histograms and free the counts.
+ */
+static void dist_close(SUBSET *w, int nband, int nhist)
+{
+        int k, b;
+
+        for(k=0; k<w->nfp; k++){
+                for(b=0; b<nband; b++){
+                        DIST *d = &w->dist[k*nband + b];
+                        if(k > 0){
+                                dist_merge(d, d - nband);
+                        }
+                        dist_quantiles(d, w->qv + ((long)k*nband + b)*DIST_NQ);
+                        if(nhist > 0){
+                                dist_hist(d, w->hv + ((long)k*nband + b)*nhist);
+                        }
+                }
+        }
+        dist_release(w, nband);
+}
+
+/* One sweep over the rows needed by any window, ROW_BLOCK rows per
+ * batch of reads. Per row only the union of the windows' column runs is
+ * fetched (per band for BIL and BSQ), placed at its column in the
+ * row-indexed buf, so a pixel shared by overlapping windows is read once.
+ * A mapped image is addressed in place and the spans only serve as
+ * prefetch hints. ord is sorted by r1.
+ * Each window row goes through the data type's kernel kfn and is merged
+ * into the window's moments, so one pass gives count, mean and M2.
+ * Nested footprints are read as the largest; each pixel goes to the
+ * moments of the innermost footprint holding it, the ring around the
+ * next smaller one, and the rings are merged outward afterwards.
+ * Blocks answered from the zone map or overview are left out of both.
+ * With scr the same runs are split by class into the windows' strata.
+ * With ds, one per band, they also go into the distributions of the
+ * windows the current row block overlaps, so no more than those hold
+ * counts at a time.
+ * With wkfn each footprint's run goes through the weighted kernel with
+ * the footprint's weights instead.
+ */
+static int sweep_rows(RASTER *ras, ENVI_HDR *envi, SUBSET **ord, int n, char *buf, PIX_FN kfn, NODATA *nd, const SCREEN *scr, const DIST_SPEC *ds, WPIX_FN wkfn)
+{
+        DIST_FN dfn = ds != NULL ? dist_select(envi->dtype, envi->il) : NULL;
+        long rowlen = (long)envi->ncol*envi->nband*ras->dsize;
+        long bstride;
+        int rmax = -1;
+        int first = 0;
+        int maxrun = 2;
+        long cap = 0;
+        int i, j, k, r, ra, rb, b;
+
+        // room for the runs of every window in a row, more where the zone map splits them
+        for(i=0; i<n; i++){
+                if(ord[i]->r2 > rmax){
+                        rmax = ord[i]->r2;
+                }
+                if(ord[i]->poly != NULL){
+                        cap += ord[i]->poly->maxrun;
+                        if(ord[i]->poly->maxrun > maxrun){
+                                maxrun = ord[i]->poly->maxrun;
+                        }
+                }
+                else if(ord[i]->skip == NULL){
+                        cap++;
+                }
+                else{
+                        cap += (long)ord[i]->nfp * (ord[i]->nbx + 2);
+                        if(ord[i]->nbx + 2 > maxrun){
+                                maxrun = ord[i]->nbx + 2;
+                        }
+                }
+        }
+
+        RSPAN *span = (RSPAN *)malloc((long)ROW_BLOCK*cap*envi->nband*sizeof(RSPAN));
+        int *iv = (int *)malloc(2*cap*sizeof(int));
+        int *run = (int *)malloc(2*maxrun*sizeof(int));
+        if(span == NULL || iv == NULL || run == NULL){
+                free(span);
+                free(iv);
+                free(run);
+                return -1;
+        }
+
+        r = ord[0]->r1;
+        while(r <= rmax){
+                // windows before first all ended above this row
+                while(ord[first]->r2 < r){
+                        first++;
+                }
+                // gap between windows, skip to the next one
+                if(ord[first]->r1 > r){
+                        r = ord[first]->r1;
+                }
+                ra = r;
+                rb = ra + ROW_BLOCK - 1 < rmax ? ra + ROW_BLOCK - 1 : rmax;
+
+                int nspan = 0;
+                for(r=ra; r<=rb; r++){
+                        // column runs of windows covering this row, sorted and merged
+                        int niv = 0;
+                        for(i=first; i<n && ord[i]->r1<=r; i++){
+                                SUBSET *w = ord[i];
+                                int nrun;
+                                if(w->r2 < r){
+                                        continue;
+                                }
+                                if(w->skip == NULL && w->poly == NULL){
+                                        if(window_run(w, w->nfp-1, r, &run[0], &run[1])){
+                                                iv_insert(iv, &niv, run[0], run[1]);
+                                        }
+                                        continue;
+                                }
+                                for(k=0; k<w->nfp; k++){
+                                        nrun = window_runs(w, k, r, run);
+                                        for(b=0; b<nrun; b++){
+                                                iv_insert(iv, &niv, run[2*b], run[2*b+1]);
+                                        }
+                                }
+                        }
+                        for(j=0; j<niv; j=k){
+                                int c2 = iv[2*j+1];
+                                for(k=j+1; k<niv && iv[2*k]<=c2+1; k++){
+                                        if(iv[2*k+1] > c2){
+                                                c2 = iv[2*k+1];
+                                        }
+                                }
+                                nspan += raster_row_spans(ras, r, iv[2*j], c2, buf + (r-ra)*rowlen, span + nspan);
+                        }
+                }
+                if(ras->il != ENVI_BIP){
+                        raster_sort_spans(span, nspan);
+                }
+
+                if(ras->direct){
+                        raster_advise(ras, span, nspan);
+                }
+                else if(0 != raster_readv(ras, span, nspan)){
+                        fprintf(stderr, "READ FAILED. row %d-%d\n", ra, rb);
+                        free(span);
+                        free(iv);
+                        free(run);
+                        return -1;
+                }
+
+                for(r=ra; r<=rb; r++){
+                        char *row = raster_row(ras, r, buf + (r-ra)*rowlen, &bstride);
+                        for(i=first; i<n && ord[i]->r1<=r; i++){
+                                SUBSET *w = ord[i];
+                                int nrun;
+                                if(w->r2 < r){
+                                        continue;
+                                }
+                                if(dfn != NULL && w->dist == NULL && 0 != dist_open(w, envi->nband, ds)){
+                                        free(span);
+                                        free(iv);
+                                        free(run);
+                                        return -1;
+                                }
+                                if(wkfn != NULL){
+                                        for(k=0; k<w->nfp; k++){
+                                                const FOOTPRINT *fp = w->fp[k];
+                                                if(window_run(w, k, r, &run[0], &run[1])){
+                                                        long c = ras->il == ENVI_BIP ? (long)run[0]*envi->nband : run[0];
+                                                        wkfn(row + c*ras->dsize, run[1]-run[0]+1, envi->nband, bstride, nd,
+                                                                        fp_weights(fp, r - w->row - fp->r0, run[0] - w->col), w->wmom + (long)k*envi->nband);
+                                                }
+                                        }
+                                        continue;
+                                }
+                                for(k=0; k<w->nfp; k++){
+                                        nrun = window_runs(w, k, r, run);
+                                        for(j=0; j<nrun; j++){
+                                                long c = ras->il == ENVI_BIP ? (long)run[2*j]*envi->nband : run[2*j];
+                                                kfn(row + c*ras->dsize, run[2*j+1]-run[2*j]+1, envi->nband, bstride, nd, w->mom + (long)k*envi->nband);
+                                                if(scr != NULL){
+                                                        strata_run(scr, w, k, r, run[2*j], run[2*j+1], row, ras->il, ras->dsize, envi->nband, bstride, kfn, nd);
+                                                }
+                                                if(dfn != NULL){
+                                                        dfn(row + c*ras->dsize, run[2*j+1]-run[2*j]+1, envi->nband, bstride, nd, w->dist + (long)k*envi->nband);
+                                                }
+                                        }
+                                }
+                        }
+                }
+                for(i=first; dfn != NULL && i<n && ord[i]->r1<=rb; i++){
+                        if(ord[i]->dist != NULL && ord[i]->r2 <= rb){
+                                dist_close(ord[i], envi->nband, ds->nhist);
+                        }
+                }
+                r = rb + 1;
+        }
+
+        free(span);
+        free(iv);
+        free(run);
+        return 0;
+}
+
+/* Window statistics from the summed-area table sidecar, no pixels read.
+ * Ring runs repeating over consecutive rows, all rows of a square, make
+ * one rectangle of four lookups.
+ */
+static void sat_windows(const SAT *sat, SUBSET *sub, int n, int nband)
 {
-        char *fenvi = argv[1];
-        double lat = atof(argv[2]);
-        double lon = atof(argv[3]);
-        int window = atoi(argv[4]);
-        int year = atoi(argv[5]);
-        int doy = atoi(argv[6]);
-        char *tile = argv[7];
-        char *sensor = argv[8];
-        char *base = argv [9];
+        int i, k, p, r;
 
+        for(i=0; i<n; i++){
+                SUBSET *w = &sub[i];
+                for(k=0; k<w->nfp; k++){
+                        MOMENT *m = w->mom + (long)k*nband;
+                        int run[4], prev[4], nrun, nprev = 0, r0 = w->r1;
+                        for(r=w->r1; r<=w->r2+1; r++){
+                                nrun = r <= w->r2 ? ring_runs(w, k, r, run) : 0;
+                                if(nrun == nprev && 0 == memcmp(run, prev, 2*nrun*sizeof(int))){
+                                        continue;
+                                }
+                                for(p=0; p<nprev; p++){
+                                        sat_rect(sat, r0, prev[2*p], r-1, prev[2*p+1], m);
+                                }
+                                memcpy(prev, run, 2*nrun*sizeof(int));
+                                nprev = nrun;
+                                r0 = r;
+                        }
+                }
+        }
+}
+
+// header of image fenvi: name.hdr for name.bin, else fenvi.hdr
+static int image_header(char *fenvi, ENVI_HDR *envi)
+{
         char hdr[1024];
         int len = strlen(fenvi);
         int i;
@@ -35,156 +697,1242 @@ int main(int argc, char *argv[])
                 }
         }
 
+        if(0 != read_envi_hdr(hdr, envi)){
+                sprintf(hdr, "%s.hdr", fenvi);
+                if(0 != read_envi_hdr(hdr, envi)){
+                        fprintf(stderr, "ENVI HEADER READ FAILED. %s\n", hdr);
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+// fill value of the image and the kernel mask for it
+static double image_nodata(ENVI_HDR *envi, NODATA *nd)
+{
+        double fill = envi->has_ignore ? envi->ignore : ALBEDO_FILL;
+        kern_nodata(envi->dtype, 1, fill, nd);
+        return fill;
+}
+
+/* Write the lat/lon grid of image fenvi, or of the square window of size
+ * win metres at slat, slon clipped to the image, to fout.
+ */
+static int geoloc_file(char *fenvi, char *fout, char *slat, char *slon, int win, int nthread, double maxerr)
+{
         ENVI_HDR envi;
+        GEO_STATS st;
+        SPACE sp;
+        int r1, r2, c1, c2;
 
-        if(0 != read_envi_hdr(hdr, &envi)){
-                sprintf(hdr, "%s.hdr", fenvi);
-                if(0 != read_envi_hdr(hdr, &envi)){
-                        printf("ENVI HEADER READ FAILED. %s\n", hdr);
+        if(0 != image_header(fenvi, &envi)){
+                return 1;
+        }
+        if(!envi.have_map){
+                fprintf(stderr, "ERROR! NO MAP INFO.\n");
+                return 1;
+        }
+        if(0 != space_init(&sp, &envi)){
+                fprintf(stderr, "PROJECTION SETUP FAILED.\n");
+                return 1;
+        }
+        r1 = c1 = 0;
+        r2 = envi.nrow - 1;
+        c2 = envi.ncol - 1;
+        if(slat != NULL){
+                double lat = atof(slat), l, s, my, mx;
+                int ny, nx;
+                if(0 != space_to(&sp, lat, atof(slon), &l, &s)){
+                        fprintf(stderr, "PROJECTION FAILED. lat=%f, lon=%s\n", lat, slon);
                         return 1;
                 }
+                // the rows and columns of a square footprint
+                space_pixel_m(&sp, lat, &my, &mx);
+                ny = win / my;
+                nx = win / mx;
+                r1 = (int)floor(l) - ny/2;
+                r2 = (int)floor(l) + ny/2;
+                c1 = (int)floor(s) - nx/2;
+                c2 = (int)floor(s) + nx/2;
+                r1 = r1 < 0 ? 0 : r1;
+                c1 = c1 < 0 ? 0 : c1;
+                r2 = r2 >= envi.nrow ? envi.nrow - 1 : r2;
+                c2 = c2 >= envi.ncol ? envi.ncol - 1 : c2;
+                if(r1 > r2 || c1 > c2){
+                        fprintf(stderr, "SITE OUT OF IMAGE.\n");
+                        return 1;
+                }
+        }
+        if(maxerr > 0 && strcmp(envi.proj, "UTM") != 0){
+                fprintf(stderr, "NOT A UTM GRID, EVERY PIXEL TRANSFORMED.\n");
+                maxerr = 0;
         }
+        if(0 != geo_write(fout, &envi, &sp, r1, r2, c1, c2, nthread, maxerr, &st)){
+                return 1;
+        }
+        fprintf(stderr, "Pixels = %lld, tiles = %d, interpolated = %d, threads = %d, max error = %.3g m\n",
+                        st.npix, st.ntile, st.ninterp, nthread, st.maxerr);
+        return 0;
+}
 
-        if(!envi.have_map){
-                printf("ERROR! NO MAP INFO.\n");
+// write the summed-area table sidecar, or the overview pyramid, of one image
+static int build_file(char *fenvi, int ovr)
+{
+        ENVI_HDR envi;
+        NODATA nd;
+
+        if(0 != image_header(fenvi, &envi)){
+                return 1;
+        }
+        if(envi.il < 0){
+                fprintf(stderr, "UNKNOWN INTERLEAVE %s.\n", envi.interleave);
                 return 1;
         }
+        if(ovr){
+                if(kern_select(envi.dtype, envi.il) == NULL){
+                        fprintf(stderr, "SKIPPED, DATA TYPE %d NOT SUPPORTED. %s\n", envi.dtype, fenvi);
+                        return 0;
+                }
+                image_nodata(&envi, &nd);
+                return ov_build(fenvi, &envi, kern_select(envi.dtype, envi.il), &nd) == 0 ? 0 : 1;
+        }
+        if(!sat_supported(envi.dtype)){
+                fprintf(stderr, "SKIPPED, DATA TYPE %d NOT INDEXED. %s\n", envi.dtype, fenvi);
+                return 0;
+        }
+        image_nodata(&envi, &nd);
+        return sat_build(fenvi, &envi, &nd) == 0 ? 0 : 1;
+}
+
+// ring k of window w holds every pixel of rows r0..r1, columns c0..c1
+static int ring_covers(const SUBSET *w, int k, int r0, int c0, int r1, int c1)
+{
+        int run[4], nrun, r, i;
+
+        if(r0 < w->r1 || r1 > w->r2 || c0 < w->c1 || c1 > w->c2){
+                return 0;
+        }
+        for(r=r0; r<=r1; r++){
+                nrun = ring_runs(w, k, r, run);
+                for(i=0; i<nrun && !(run[2*i] <= c0 && run[2*i+1] >= c1); i++);
+                if(i == nrun){
+                        return 0;
+                }
+        }
+        return 1;
+}
+
+/* Skip flags of cell x cell blocks under each window, all clear. *skip
+ * receives the flags of all windows, to be freed.
+ */
+static int skip_grid(SUBSET *sub, int n, int cell, unsigned char **skip)
+{
+        long total = 0;
+        int i;
+
+        for(i=0; i<n; i++){
+                SUBSET *w = &sub[i];
+                w->cell = cell;
+                w->by0 = w->r1 / cell;
+                w->bx0 = w->c1 / cell;
+                w->nby = w->r2 / cell - w->by0 + 1;
+                w->nbx = w->c2 / cell - w->bx0 + 1;
+                total += (long)w->nfp * w->nby * w->nbx;
+        }
+        *skip = (unsigned char *)calloc(total, 1);
+        if(*skip == NULL){
+                return -1;
+        }
+        total = 0;
+        for(i=0; i<n; i++){
+                sub[i].skip = *skip + total;
+                total += (long)sub[i].nfp * sub[i].nby * sub[i].nbx;
+        }
+        return 0;
+}
+
+/* Zone map blocks under each window. A block without valid values is
+ * skipped for all footprints; a block wholly inside a footprint ring is
+ * merged from the map, read once and recorded first if not built yet,
+ * which takes no more reads than the sweep would. A block the window
+ * only partly covers is never built for it and is left to the sweep.
+ * *skip receives the flags of all windows, to be freed.
+ */
+static int zm_windows(ZMAP *zm, RASTER *ras, ENVI_HDR *envi, SUBSET *sub, int n, PIX_FN kfn, NODATA *nd, unsigned char **skip)
+{
+        int i, k, by, bx, b;
+
+        if(0 != skip_grid(sub, n, ZM_BLOCK, skip)){
+                return -1;
+        }
+        for(i=0; i<n; i++){
+                SUBSET *w = &sub[i];
+                for(by=w->by0; by<w->by0+w->nby; by++){
+                        for(bx=w->bx0; bx<w->bx0+w->nbx; bx++){
+                                int r1 = by*ZM_BLOCK + ZM_BLOCK < envi->nrow ? by*ZM_BLOCK + ZM_BLOCK - 1 : envi->nrow - 1;
+                                int c1 = bx*ZM_BLOCK + ZM_BLOCK < envi->ncol ? bx*ZM_BLOCK + ZM_BLOCK - 1 : envi->ncol - 1;
+                                const ZSTAT *zs = zm_block(zm, by, bx);
+                                // the rings are disjoint, so at most one holds the block
+                                for(k=0; k<w->nfp && !ring_covers(w, k, by*ZM_BLOCK, bx*ZM_BLOCK, r1, c1); k++);
+                                if(zs == NULL){
+                                        if(k == w->nfp){
+                                                continue;
+                                        }
+                                        if(0 != zm_build_block(zm, ras, envi->dtype, by, bx, kfn, nd)){
+                                                return -1;
+                                        }
+                                        zs = zm_block(zm, by, bx);
+                                }
+                                if(zm_empty(zm, by, bx)){
+                                        for(k=0; k<w->nfp; k++){
+                                                w->skip[((long)k*w->nby + by - w->by0)*w->nbx + bx - w->bx0] = 1;
+                                        }
+                                }
+                                else if(k < w->nfp){
+                                        for(b=0; b<envi->nband; b++){
+                                                moment_merge(&w->mom[(long)k*envi->nband + b], &zs[b].m);
+                                        }
+                                        w->skip[((long)k*w->nby + by - w->by0)*w->nbx + bx - w->bx0] = 1;
+                                }
+                        }
+                }
+        }
+        return 0;
+}
+
+/* Cell (cy, cx) of level l for ring k of window w: a cell without valid
+ * values is skipped, one wholly inside the ring is merged from the
+ * pyramid, and one on the ring's edge is split into its four children
+ * down to the finest level, whose edge cells are left to the sweep.
+ */
+static void ov_descend(const OVERVIEW *ov, SUBSET *w, int k, int l, int cy, int cx)
+{
+        int r0 = cy << l, c0 = cx << l;
+        int r1 = r0 + (1 << l) - 1, c1 = c0 + (1 << l) - 1;
+        const MOMENT *m;
+        int b, y, x, q;
+
+        if(cy >= ov->ny[l] || cx >= ov->nx[l] || r0 > w->r2 || c0 > w->c2 || r1 < w->r1 || c1 < w->c1){
+                return;
+        }
+        r1 = r1 < ov->nrow ? r1 : ov->nrow - 1;
+        c1 = c1 < ov->ncol ? c1 : ov->ncol - 1;
+        m = ov_cell(ov, l, cy, cx);
+        for(b=0; b<ov->nband && m[b].n == 0; b++);
+
+        if(b == ov->nband || ring_covers(w, k, r0, c0, r1, c1)){
+                for(b=0; b<ov->nband; b++){
+                        moment_merge(&w->mom[(long)k*ov->nband + b], &m[b]);
+                }
+                // finest cells of this one that lie under the window
+                for(y=r0>>OV_MIN_LEVEL; y<=r1>>OV_MIN_LEVEL; y++){
+                        if(y < w->by0 || y >= w->by0 + w->nby){
+                                continue;
+                        }
+                        for(x=c0>>OV_MIN_LEVEL; x<=c1>>OV_MIN_LEVEL; x++){
+                                if(x >= w->bx0 && x < w->bx0 + w->nbx){
+                                        w->skip[((long)k*w->nby + y - w->by0)*w->nbx + x - w->bx0] = 1;
+                                }
+                        }
+                }
+                return;
+        }
+        if(l == OV_MIN_LEVEL){
+                return;
+        }
+        for(q=0; q<4; q++){
+                ov_descend(ov, w, k, l-1, 2*cy + q/2, 2*cx + q%2);
+        }
+}
+
+/* Windows from the overview pyramid and their edge pixels. Each ring
+ * starts at the coarsest level whose cells fit in the window and descends
+ * where the ring edge cuts a cell; the cells merged are exact moments, so
+ * the result equals reading every pixel up to rounding. *skip receives
+ * the flags of the finest cells answered, to be freed.
+ */
+static int ov_windows(const OVERVIEW *ov, SUBSET *sub, int n, unsigned char **skip)
+{
+        int i, k, l, cy, cx;
+
+        if(0 != skip_grid(sub, n, 1 << OV_MIN_LEVEL, skip)){
+                return -1;
+        }
+        for(i=0; i<n; i++){
+                SUBSET *w = &sub[i];
+                int size = w->r2 - w->r1 < w->c2 - w->c1 ? w->r2 - w->r1 + 1 : w->c2 - w->c1 + 1;
+                for(l=OV_MIN_LEVEL; l<ov->top && (2 << l) <= size; l++);
+                for(k=0; k<w->nfp; k++){
+                        for(cy=w->r1>>l; cy<=w->r2>>l; cy++){
+                                for(cx=w->c1>>l; cx<=w->c2>>l; cx++){
+                                        ov_descend(ov, w, k, l, cy, cx);
+                                }
+                        }
+                }
+        }
+        return 0;
+}
 
-        long proj_num = SNSOID;
-        long sphere = -1;
-        double ul_x = -20015109.354;
-        double ul_y = 10007554.677;
-        double pix_size = 926.6254330555556;
-        //double proj_param[15] = {6371007.181,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
-        double proj_param[15] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
-        long utm_zone = -1;
+/* Open the SCL image of fenvi and read the classes under each window.
+ * *cls receives the classes of all windows, to be freed.
+ */
+static int scl_windows(RUN *run, char *fenvi, ENVI_HDR *envi, SUBSET *sub, int n, SCL *scl, unsigned char **cls)
+{
+        char fscl[4096];
+        ENVI_HDR hscl;
+        long total = 0;
+        int i;
 
-        // currently only consider utm
-        if(strcmp(envi.proj, "UTM") == 0){
-                proj_num = UTM;
+        if(0 != find_sibling(fenvi, run->scl, fscl, sizeof(fscl))){
+                fprintf(stderr, "NO SCL IMAGE %s NEXT TO %s\n", run->scl, fenvi);
+                return -1;
+        }
+        if(0 != image_header(fscl, &hscl) || 0 != scl_open(scl, fscl, &hscl, envi)){
+                return -1;
         }
-        if(strcmp(envi.datum, "WGS-84") == 0){
-                sphere = 12;
+        for(i=0; i<n; i++){
+                SUBSET *w = &sub[i];
+                w->s1 = scl_div(w->r1 + scl->oy, scl->f);
+                w->t1 = scl_div(w->c1 + scl->ox, scl->f);
+                w->nt = scl_div(w->c2 + scl->ox, scl->f) - w->t1 + 1;
+                total += (long)(scl_div(w->r2 + scl->oy, scl->f) - w->s1 + 1) * w->nt;
+        }
+        *cls = (unsigned char *)malloc(total);
+        if(*cls == NULL){
+                scl_close(scl);
+                return -1;
+        }
+        total = 0;
+        for(i=0; i<n; i++){
+                SUBSET *w = &sub[i];
+                int s2 = scl_div(w->r2 + scl->oy, scl->f);
+                w->cls = *cls + total;
+                total += (long)(s2 - w->s1 + 1) * w->nt;
+                if(0 != scl_read(scl, w->s1, w->t1, s2, w->t1 + w->nt - 1, w->cls)){
+                        scl_close(scl);
+                        return -1;
+                }
         }
-        ul_x = envi.upleftX;
-        ul_y = envi.upleftY;
-        pix_size = envi.pixsizeX;
-        utm_zone = envi.utmzone;
+        return 0;
+}
 
-        assert(0 == SetupSpace(proj_num, utm_zone, proj_param, sphere, ul_x, ul_y, pix_size));
+// mean, sd and count of a moment in physical units; empty, the fill value as is for both
+static void print_moment(FILE *out, const MOMENT *m, double fill, double gain, double offset)
+{
+        MOMENT s = *m;
 
-        double l, s;
-        assert(0 == ToSpace(lat, lon, &l, &s));
+        if(s.n == 0){
+                fprintf(out, "%.15g,%.15g,0", fill, fill);
+                return;
+        }
+        moment_scale(&s, gain, offset);
+        fprintf(out, "%.6f,%.6f,%lld", s.mean, moment_sd(&s), s.n);
+}
 
-        //printf("lat=%f, lon=%f, line=%f, sample=%f\n", lat, lon, l, s);
+/* Subset one image for all sites of the run. In site list mode sites
+ * outside the image are skipped and the site id leads each output row.
+ * With a current sidecar the windows are answered from it instead.
+ */
+static int subset_file(RUN *run, char *fenvi, int year, int doy, char *tile, char *sensor, char *base)
+{
+        SITE *sites = run->sites;
+        int nsite = run->nsite;
+        FILE *out = run->out;
+        ENVI_HDR envi;
+        int i;
 
-        // read & average
-        int np = window / envi.pixsizeX;
-        int row = (int)l;
-        int col = (int)s;
+        if(0 != image_header(fenvi, &envi)){
+                return 1;
+        }
 
-        int r1 = row - np/2;
-        int r2 = row + np/2;
-        int c1 = col - np/2;
-        int c2 = col + np/2;
-        
-        assert(r1>=0 && r1<envi.nrow);
-        assert(r2>=0 && r2<envi.nrow);
-        assert(c1>=0 && c1<envi.ncol);
-        assert(c2>=0 && c2<envi.ncol);
+        if(!envi.have_map){
+                fprintf(stderr, "ERROR! NO MAP INFO.\n");
+                return 1;
+        }
 
-        //bip
-        if(strcmp(envi.interleave, "bip") != 0){
-                printf("THIS IS FOR BIP.\n");
+        if(envi.il < 0){
+                fprintf(stderr, "UNKNOWN INTERLEAVE %s.\n", envi.interleave);
+                return 1;
+        }
+        if(kern_select(envi.dtype, envi.il) == NULL){
+                fprintf(stderr, "UNSUPPORTED DATA TYPE %d.\n", envi.dtype);
                 return 1;
         }
 
-        int sum[envi.nband];
-        int cnt[envi.nband];
-        int var[envi.nband];
+        SPACE sp;
+        if(0 != space_init(&sp, &envi)){
+                fprintf(stderr, "PROJECTION SETUP FAILED.\n");
+                return 1;
+        }
 
-        short buf[envi.ncol*envi.nband];
-        int r, c, b;
+        SUBSET *sub = (SUBSET *)malloc(nsite*sizeof(SUBSET));
+        SUBSET **ord = (SUBSET **)malloc(nsite*sizeof(SUBSET *));
+        int nfp = run->nfp > 0 ? run->nfp : 1;
+        MOMENT *mom = (MOMENT *)malloc((long)nsite*nfp*envi.nband*sizeof(MOMENT));
+        MOMENT *smom = NULL;
+        long long *ncls = NULL;
+        MOMENT *bmom = NULL;
+        WMOMENT *wmom = NULL;
+        POLY_SPANS *pspan = NULL;
+        double *vy = NULL, *vx = NULL;
+        double *qv = NULL;
+        long long *hv = NULL;
+        DIST_SPEC *ds = NULL;
+        unsigned char *cls = NULL;
+        SCL scl;
+        SCREEN scr;
+        int nsub = 0;
+        int every;
+        int ret = 1;
+        int b, k;
+        char *buf = NULL;
+        PIX_FN kfn = kern_select(envi.dtype, envi.il);
+        NODATA nd;
+        double fill;
+        double *gain = (double *)malloc(2L*envi.nband*sizeof(double));
+        double *off;
+        SAT sat;
+        ZMAP zm;
+        OVERVIEW ov;
+        unsigned char *skip = NULL;
+        RASTER ras;
+        memset(&ras, 0, sizeof(RASTER));
+        ras.fd = -1;
 
-        for(b=0; b<envi.nband; b++){
-                sum[b] = 0;
-                cnt[b] = 0;
-                var[b] = 0;
+        if(sub == NULL || ord == NULL || mom == NULL || gain == NULL){
+                goto done;
+        }
+        off = gain + envi.nband;
+        if(run->scl != NULL){
+                smom = (MOMENT *)malloc((long)nsite*nfp*2*envi.nband*sizeof(MOMENT));
+                ncls = (long long *)calloc((long)nsite*nfp*SCL_NCLASS, sizeof(long long));
+                bmom = (MOMENT *)malloc((long)nsite*nfp*SCL_NCLASS*sizeof(MOMENT));
+                if(smom == NULL || ncls == NULL || bmom == NULL){
+                        goto done;
+                }
+        }
+        if(run->area){
+                wmom = (WMOMENT *)malloc((long)nsite*nfp*envi.nband*sizeof(WMOMENT));
+                if(wmom == NULL){
+                        goto done;
+                }
+        }
+        if(run->poly != NULL){
+                int npt = 0;
+                for(i=0; i<nsite; i++){
+                        npt = run->poly[i].npt > npt ? run->poly[i].npt : npt;
+                }
+                pspan = (POLY_SPANS *)malloc(nsite*sizeof(POLY_SPANS));
+                vy = (double *)malloc(npt*sizeof(double));
+                vx = (double *)malloc(npt*sizeof(double));
+                if(pspan == NULL || vy == NULL || vx == NULL){
+                        goto done;
+                }
+        }
+        else{
+                // all sites to lines and samples in one batch
+                double *v = (double *)malloc(2L*nsite*sizeof(double));
+                vy = (double *)malloc(nsite*sizeof(double));
+                vx = (double *)malloc(nsite*sizeof(double));
+                if(v == NULL || vy == NULL || vx == NULL){
+                        free(v);
+                        goto done;
+                }
+                for(i=0; i<nsite; i++){
+                        v[i] = sites[i].lat;
+                        v[nsite+i] = sites[i].lon;
+                }
+                space_to_n(&sp, v, v + nsite, vy, vx, nsite);
+                free(v);
+        }
+        if(run->use_dist){
+                qv = (double *)malloc((long)nsite*nfp*envi.nband*DIST_NQ*sizeof(double));
+                hv = (long long *)calloc((long)nsite*nfp*envi.nband*(run->nhist > 0 ? run->nhist : 1), sizeof(long long));
+                if(qv == NULL || hv == NULL){
+                        goto done;
+                }
         }
 
-        FILE *fp = fopen(fenvi, "rb");
-        assert(fp != NULL);
+        for(i=0; i<nsite; i++){
+                SUBSET *w = &sub[nsub];
+                double l, s, my, mx;
+                w->warp = NULL;
+                if(run->poly != NULL){
+                        // vertices to image lines and samples, row spans by scanline
+                        const POLYGON *pg = &run->poly[i];
+                        POLY_SPANS *ps = &pspan[nsub];
+                        if(0 != space_to_n(&sp, pg->lat, pg->lon, vy, vx, pg->npt)){
+                                fprintf(stderr, "PROJECTION FAILED. polygon %s\n", pg->id);
+                                continue;
+                        }
+                        if(0 != poly_rasterize(vy, vx, pg->ring, pg->nring, ps)){
+                                fprintf(stderr, "NO PIXEL IN POLYGON %s\n", pg->id);
+                                continue;
+                        }
+                        if(ps->r1<0 || ps->r2>=envi.nrow || ps->c1<0 || ps->c2>=envi.ncol){
+                                poly_spans_free(ps);
+                                continue;
+                        }
+                        w->poly = ps;
+                        w->fp[0] = NULL;
+                        w->row = w->col = 0;
+                        w->r1 = ps->r1;
+                        w->r2 = ps->r2;
+                        w->c1 = ps->c1;
+                        w->c2 = ps->c2;
+                        goto window;
+                }
+                l = vy[i];
+                s = vx[i];
+                if(l != l || s != s){
+                        fprintf(stderr, "PROJECTION FAILED. lat=%f, lon=%f\n", sites[i].lat, sites[i].lon);
+                        if(run->multi){
+                                continue;
+                        }
+                        goto done;
+                }
 
-        for(r=r1; r<=r2; r++){
-                //printf("row=%d, seek pos= %ld\n", r, 2*r*envi.ncol*envi.nband);
-                assert(0 == fseek(fp, 2*r*envi.ncol*envi.nband, SEEK_SET));
-                assert(envi.ncol*envi.nband == fread(buf, 2, envi.ncol*envi.nband, fp));
-                for(c=c1; c<=c2; c++){
-                        for(b=0; b<envi.nband; b++){
-                                if(buf[c*envi.nband+b] != 32767){
-                                        sum[b] += buf[c*envi.nband+b];
-                                        cnt[b] ++;
-                                }       
-                                /*if(r == row && c == col){
-                                        printf("ROW %d COL %d BAND %d: %d\n", r, c, b, buf[c*envi.nband+b]);
-                                }*/
-                        }               
+                //printf("lat=%f, lon=%f, line=%f, sample=%f\n", lat, lon, l, s);
+
+                if(run->warp > 0){
+                        // footprints on the site's own grid, sampled from this image
+                        if(l < 0 || l >= envi.nrow || s < 0 || s >= envi.ncol){
+                                w->r1 = w->r2 = (int)floor(l);
+                                w->c1 = w->c2 = (int)floor(s);
+                                goto bounds;
+                        }
+                        if(run->nfp > 0){
+                                w->warp = warp_get(&run->wpc, &sp, sites[i].lat, sites[i].lon, run->warp, run->fpshape, run->fpsize, nfp);
+                        }
+                        else{
+                                w->warp = warp_get(&run->wpc, &sp, sites[i].lat, sites[i].lon, run->warp, sites[i].shape, &sites[i].window, 1);
+                        }
+                        if(w->warp == NULL){
+                                goto done;
+                        }
+                        w->poly = NULL;
+                        w->fp[0] = NULL;
+                        w->row = (int)floor(l);
+                        w->col = (int)floor(s);
+                        w->r1 = w->warp->r1;
+                        w->r2 = w->warp->r2;
+                        w->c1 = w->warp->c1;
+                        w->c2 = w->warp->c2;
+                        goto bounds;
+                }
+
+                w->poly = NULL;
+                w->row = (int)floor(l);
+                w->col = (int)floor(s);
+                space_pixel_m(&sp, sites[i].lat, &my, &mx);
+                for(k=0; k<nfp; k++){
+                        if(run->nfp > 0){
+                                w->fp[k] = fp_get(&run->fpc, run->fpshape, run->area, run->fpsize[k], my, mx, l - w->row, s - w->col);
+                        }
+                        else{
+                                w->fp[k] = fp_get(&run->fpc, sites[i].shape, run->area, sites[i].window, my, mx, l - w->row, s - w->col);
+                        }
+                        if(w->fp[k] == NULL){
+                                goto done;
+                        }
+                }
+                w->r1 = w->row + w->fp[nfp-1]->r0;
+                w->r2 = w->row + w->fp[nfp-1]->r1;
+                w->c1 = w->col + w->fp[nfp-1]->cmin;
+                w->c2 = w->col + w->fp[nfp-1]->cmax;
+
+bounds:
+                if(w->r1<0 || w->r2>=envi.nrow || w->c1<0 || w->c2>=envi.ncol){
+                        if(run->multi){
+                                continue;
+                        }
+                        fprintf(stderr, "WINDOW OUTSIDE IMAGE. row %d-%d, col %d-%d\n", w->r1, w->r2, w->c1, w->c2);
+                        goto done;
                 }
+
+window:
+                w->site = &sites[i];
+                w->nfp = nfp;
+                w->mom = mom + (long)nsub*nfp*envi.nband;
+                w->skip = NULL;
+                w->cls = NULL;
+                w->dist = NULL;
+                if(run->area){
+                        w->wmom = wmom + (long)nsub*nfp*envi.nband;
+                        for(b=0; b<nfp*envi.nband; b++){
+                                wmoment_init(&w->wmom[b]);
+                        }
+                }
+                if(run->use_dist){
+                        w->qv = qv + (long)nsub*nfp*envi.nband*DIST_NQ;
+                        w->hv = hv + (long)nsub*nfp*envi.nband*run->nhist;
+                        for(b=0; b<nfp*envi.nband*DIST_NQ; b++){
+                                w->qv[b] = NAN;
+                        }
+                }
+                for(b=0; b<nfp*envi.nband; b++){
+                        moment_init(&w->mom[b]);
+                }
+                if(run->scl != NULL){
+                        w->smom = smom + (long)nsub*nfp*2*envi.nband;
+                        w->ncls = ncls + (long)nsub*nfp*SCL_NCLASS;
+                        w->bmom = bmom + (long)nsub*nfp*SCL_NCLASS;
+                        for(b=0; b<nfp*2*envi.nband; b++){
+                                moment_init(&w->smom[b]);
+                        }
+                        for(b=0; b<nfp*SCL_NCLASS; b++){
+                                moment_init(&w->bmom[b]);
+                        }
+                }
+                ord[nsub] = w;
+                nsub++;
         }
 
+        if(nsub == 0){
+                ret = 0;
+                goto done;
+        }
+        fill = image_nodata(&envi, &nd);
+        envi_gain(&envi, ALBEDO_SCALE, gain, off);
 
+        if(run->scl != NULL){
+                if(run->use_n2b && run->n2b.nband != envi.nband){
+                        fprintf(stderr, "N2B COEFFICIENTS FOR %d BANDS, IMAGE HAS %d. %s\n", run->n2b.nband, envi.nband, fenvi);
+                        goto done;
+                }
+                if(0 != scl_windows(run, fenvi, &envi, sub, nsub, &scl, &cls)){
+                        goto done;
+                }
+                scl_close(&scl);
+                scr.scl = &scl;
+                scr.n2bfn = run->use_n2b ? kern_n2b_select(envi.dtype, envi.il) : NULL;
+                n2b_fold(&run->n2b, gain, off, &scr.n2b);
+        }
+        if(run->use_dist){
+                // histogram range of each band in its stored values
+                ds = (DIST_SPEC *)malloc(envi.nband*sizeof(DIST_SPEC));
+                if(ds == NULL){
+                        goto done;
+                }
+                for(b=0; b<envi.nband; b++){
+                        ds[b].dtype = envi.dtype;
+                        ds[b].nhist = run->nhist;
+                        ds[b].lo = (run->hlo - off[b]) / gain[b];
+                        ds[b].hi = (run->hhi - off[b]) / gain[b];
+                }
+        }
 
+        // screening, distributions, weights, polygons and warps need every pixel, the sidecars only hold sums over footprints
+        every = run->scl != NULL || run->use_dist || run->area || run->poly != NULL || run->warp > 0;
+        if(run->use_sat && !every && 0 == sat_open(&sat, fenvi, &envi, &nd)){
+                sat_windows(&sat, sub, nsub, envi.nband);
+                sat_close(&sat);
+                run->nsat++;
+        }
+        else{
+                qsort(ord, nsub, sizeof(SUBSET *), cmp_subset_row);
 
-        for(b=0; b<envi.nband; b++){
-                if(cnt[b] > 0){
-                        sum[b] /= cnt[b];
+                if(0 != raster_open(&ras, fenvi, run->use_map) || 0 != raster_layout(&ras, &envi)){
+                        fprintf(stderr, "CAN NOT OPEN %s\n", fenvi);
+                        goto done;
                 }
-                else{
-                        sum[b] = 32767;
+                if(ras.size < ras.hoffset + (long long)ras.dsize*envi.nrow*envi.ncol*envi.nband){
+                        fprintf(stderr, "FILE SHORTER THAN HEADER SAYS. %s\n", fenvi);
+                        goto done;
+                }
+                if(!ras.direct){
+                        buf = (char *)malloc((long)ROW_BLOCK*envi.ncol*envi.nband*ras.dsize);
+                        if(buf == NULL){
+                                goto done;
+                        }
+                }
+                if(every){
+                        // windows all read
+                }
+                else if(run->use_ovr && 0 == ov_open(&ov, fenvi, &envi, &nd)){
+                        int err = ov_windows(&ov, sub, nsub, &skip);
+                        ov_close(&ov);
+                        if(err != 0){
+                                goto done;
+                        }
+                        run->novr++;
+                }
+                else if(run->use_zmap && 0 == zm_open(&zm, fenvi, &envi, &nd, run->save_zmap)){
+                        int err = zm_windows(&zm, &ras, &envi, sub, nsub, kfn, &nd, &skip);
+                        run->nblock += zm.nbuilt;
+                        zm_close(&zm);
+                        if(err != 0){
+                                goto done;
+                        }
+                }
+                if(run->warp > 0){
+                        for(i=0; i<nsub; i++){
+                                if(0 != warp_stats(sub[i].warp, &ras, &envi, kern_select(envi.dtype, ENVI_BIP), &nd, sub[i].mom)){
+                                        goto done;
+                                }
+                        }
+                }
+                else if(0 != sweep_rows(&ras, &envi, ord, nsub, buf, kfn, &nd, run->scl != NULL ? &scr : NULL, ds, run->area ? kern_wselect(envi.dtype, envi.il) : NULL)){
+                        goto done;
+                }
+        }
+
+        for(i=0; run->area && i<nsub; i++){
+                // footprints are whole, reported as plain moments
+                for(b=0; b<nfp*envi.nband; b++){
+                        sub[i].mom[b] = wmoment_moment(&sub[i].wmom[b]);
                 }
         }
 
-        for(r=r1; r<=r2; r++){
-                //printf("row=%d, seek pos= %ld\n", r, 2*r*envi.ncol*envi.nband);
-                assert(0 == fseek(fp, 2*r*envi.ncol*envi.nband, SEEK_SET));
-                assert(envi.ncol*envi.nband == fread(buf, 2, envi.ncol*envi.nband, fp));
-                for(c=c1; c<=c2; c++){
+        for(i=0; i<nsub; i++){
+                SUBSET *w = &sub[i];
+
+                for(k=0; k<nfp; k++){
+                        MOMENT *m = w->mom + (long)k*envi.nband;
+
+                        if(k > 0 && !run->area){
+                                // ring k plus everything inside it
+                                for(b=0; b<envi.nband; b++){
+                                        moment_merge(&m[b], &m[b-envi.nband]);
+                                }
+                                if(run->scl != NULL){
+                                        for(b=0; b<2*envi.nband; b++){
+                                                moment_merge(&w->smom[(long)k*2*envi.nband + b], &w->smom[(long)(k-1)*2*envi.nband + b]);
+                                        }
+                                        for(b=0; b<SCL_NCLASS; b++){
+                                                w->ncls[k*SCL_NCLASS + b] += w->ncls[(k-1)*SCL_NCLASS + b];
+                                                moment_merge(&w->bmom[k*SCL_NCLASS + b], &w->bmom[(k-1)*SCL_NCLASS + b]);
+                                        }
+                                }
+                        }
+                        if(run->multi){
+                                fprintf(out, "%s,", w->site->id);
+                        }
+                        if(run->nfp > 1){
+                                fprintf(out, "%s_%d,", run->fpshape == FP_CIRCLE ? "circle" : "square", run->fpsize[k]);
+                        }
+                        fprintf(out, "%s,%d,%03d,%f,%f,%s,%s,", tile, year, doy, w->site->lat, w->site->lon, sensor, base);    
                         for(b=0; b<envi.nband; b++){
-                                if(buf[c*envi.nband+b] != 32767){
-                                        var[b] += (buf[c*envi.nband+b]-sum[b])*(buf[c*envi.nband+b]-sum[b]);
-                                }       
-                                /*if(r == row && c == col){
-                                        printf("ROW %d COL %d BAND %d: %d\n", r, c, b, buf[c*envi.nband+b]);
-                                }*/
-                        }               
+                                print_moment(out, &m[b], fill, gain[b], off[b]);
+                                fputs(b < envi.nband-1 ? "," : "", out);
+                        }
+                        if(run->scl != NULL){
+                                const MOMENT *sm = w->smom + (long)k*2*envi.nband;
+                                for(b=0; b<2*envi.nband; b++){
+                                        // snow free then snow of each band
+                                        fputc(',', out);
+                                        print_moment(out, &sm[(b%2)*envi.nband + b/2], fill, gain[b/2], off[b/2]);
+                                }
+                                for(b=0; b<SCL_NCLASS; b++){
+                                        fprintf(out, ",%lld", w->ncls[k*SCL_NCLASS + b]);
+                                }
+                        }
+                        if(run->use_n2b){
+                                // broadband is in reflectance already
+                                MOMENT all;
+                                moment_init(&all);
+                                for(b=0; b<SCL_NCLASS; b++){
+                                        moment_merge(&all, &w->bmom[k*SCL_NCLASS + b]);
+                                }
+                                fputc(',', out);
+                                print_moment(out, &all, fill, 1.0, 0.0);
+                                for(b=0; b<SCL_NCLASS; b++){
+                                        if(run->n2b.set[b]){
+                                                fputc(',', out);
+                                                print_moment(out, &w->bmom[k*SCL_NCLASS + b], fill, 1.0, 0.0);
+                                        }
+                                }
+                        }
+                        if(run->use_dist){
+                                for(b=0; b<envi.nband; b++){
+                                        const double *q = w->qv + ((long)k*envi.nband + b)*DIST_NQ;
+                                        const long long *h = w->hv + ((long)k*envi.nband + b)*run->nhist;
+                                        int j;
+                                        for(j=0; j<DIST_NQ; j++){
+                                                // a negative gain turns the stored quantiles around
+                                                double x = q[gain[b] < 0 ? DIST_NQ-1-j : j];
+                                                if(x == x){
+                                                        fprintf(out, ",%.6f", gain[b] * x + off[b]);
+                                                }
+                                                else{
+                                                        fprintf(out, ",%.15g", fill);
+                                                }
+                                        }
+                                        for(j=0; j<run->nhist; j++){
+                                                fprintf(out, ",%lld", h[j]);
+                                        }
+                                }
+                        }
+                        fputc('\n', out);
                 }
         }
+        ret = 0;
 
+done:
+        for(i=0; i<nsub; i++){
+                dist_release(&sub[i], envi.nband);
+                if(sub[i].poly != NULL){
+                        poly_spans_free(sub[i].poly);
+                }
+        }
+        run->io.nreq += ras.io.nreq;
+        run->io.nused += ras.io.nused;
+        run->io.ncall += ras.io.ncall;
+        raster_close(&ras);
+        free(skip);
+        free(cls);
+        free(smom);
+        free(ncls);
+        free(bmom);
+        free(wmom);
+        free(pspan);
+        free(vy);
+        free(vx);
+        free(qv);
+        free(hv);
+        free(ds);
+        free(gain);
+        free(buf);
+        free(mom);
+        free(ord);
+        free(sub);
+        return ret;
+}
 
+// write the sidecars, or the overview pyramids, of all images found
+static int build_batch(char *src, char *pattern, int ovr)
+{
+        FILE_LIST list;
+        int i, nerr = 0;
 
-        for(b=0; b<envi.nband; b++){
-                if(cnt[b] > 0){
-                        var[b] = sqrt(var[b] / cnt[b]);
+        if(0 != collect_files(src, pattern, &list)){
+                return 1;
+        }
+        fprintf(stderr, "Number of files found = %d\n", list.n);
+        for(i=0; i<list.n; i++){
+                if(0 != build_file(list.path[i], ovr)){
+                        fprintf(stderr, "ERROR, indexing %s\n", list.path[i]);
+                        nerr++;
+                }
+        }
+        fprintf(stderr, "Sidecars built = %d, failed = %d\n", list.n-nerr, nerr);
+        free_file_list(&list);
+        return nerr > 0;
+}
+
+/* Column name of band b: its band name in the header, anything but
+ * letters, digits, '-' and '.' made '_'. Without one the script's BSA
+ * and WSA for the first two bands, and B<b+1> for the others.
+ */
+static void band_label(const ENVI_HDR *envi, int b, char *s)
+{
+        static const char *albedo[2] = {"BSA", "WSA"};
+        char *p;
+
+        if(b >= envi->nbname || envi->bname[b][0] == '\0'){
+                if(b < 2){
+                        strcpy(s, albedo[b]);
                 }
                 else{
-                        var[b] = 32767;
+                        sprintf(s, "B%d", b+1);
+                }
+                return;
+        }
+        strcpy(s, envi->bname[b]);
+        for(p=s; *p!='\0'; p++){
+                if(!isalnum((unsigned char)*p) && *p != '-' && *p != '.'){
+                        *p = '_';
                 }
         }
+}
+
+static int run_batch(RUN *run, char *src, char *pattern, char *fout)
+{
+        FILE_LIST list;
+        FILE *out = stdout;
+        ENVI_HDR envi, h;
+        char *tile = "PATH000_ROW000";
+        char *sensor = "MSI";
+        char bn[ENVI_MAX_NAME];
+        int i, b, year, doy, first = -1, nerr = 0;
 
-        printf("%s,%d,%03d,%f,%f,%s,%s,", tile, year, doy, lat, lon, sensor, base);    
+        if(0 != collect_files(src, pattern, &list)){
+                return 1;
+        }
+        fprintf(stderr, "Number of files found = %d, kernel = %s\n", list.n, kernel_name());
+
+        // one CSV header for all images, so they must have the same bands; the first names them
+        memset(&envi, 0, sizeof(ENVI_HDR));
+        for(i=0; i<list.n; i++){
+                if(0 != image_header(list.path[i], &h)){
+                        continue;
+                }
+                if(first < 0){
+                        envi = h;
+                        first = i;
+                }
+                else if(h.nband != envi.nband){
+                        fprintf(stderr, "BAND COUNT DIFFERS, %d IN %s, %d IN %s\n", h.nband, list.path[i], envi.nband, list.path[first]);
+                        free_file_list(&list);
+                        return 1;
+                }
+        }
+
+        if(fout != NULL){
+                out = fopen(fout, "w");
+                if(out == NULL){
+                        fprintf(stderr, "CAN NOT OPEN OUTPUT %s\n", fout);
+                        free_file_list(&list);
+                        return 1;
+                }
+        }
+        run->out = out;
+        if(run->multi){
+                fprintf(out, "Site_ID,");
+        }
+        if(run->nfp > 1){
+                fprintf(out, "Footprint,");
+        }
+        fprintf(out, "Path_Row,Year,DOY,Lat,Lon,Sensor,Scene_ID");
         for(b=0; b<envi.nband; b++){
-                //printf("AVERAGE BAND %d: %d, COUNT: %d\n", b, sum[b], cnt[b]);
-                if(b < envi.nband-1){
-                        printf("%.3f,", sum[b]/10000.0);
-                        printf("%.3f,", var[b]/10000.0);
-                        printf("%d,", cnt[b]);
+                band_label(&envi, b, bn);
+                fprintf(out, ",%s_mean,%s_sd,%s_count", bn, bn, bn);
+        }
+        if(run->scl != NULL){
+                // snow free then snow of each band, as the rows
+                for(b=0; b<envi.nband; b++){
+                        band_label(&envi, b, bn);
+                        fprintf(out, ",%s_free_mean,%s_free_sd,%s_free_count", bn, bn, bn);
+                        fprintf(out, ",%s_snow_mean,%s_snow_sd,%s_snow_count", bn, bn, bn);
                 }
-                else{
-                        printf("%.3f,", sum[b]/10000.0);
-                        printf("%.3f,", var[b]/10000.0);
-                        printf("%d\n", cnt[b]);
+                fprintf(out, ",SCL_nodata,SCL_clear,SCL_cloud,SCL_snow");
+        }
+        if(run->use_n2b){
+                fprintf(out, ",SW_mean,SW_sd,SW_count");
+                for(i=0; i<SCL_NCLASS; i++){
+                        if(run->n2b.set[i]){
+                                fprintf(out, ",SW_%s_mean,SW_%s_sd,SW_%s_count", n2b_class_name(i), n2b_class_name(i), n2b_class_name(i));
+                        }
+                }
+        }
+        if(run->use_dist){
+                int j;
+                for(b=0; b<envi.nband; b++){
+                        band_label(&envi, b, bn);
+                        fprintf(out, ",%s_p5,%s_p25,%s_median,%s_p75,%s_p95", bn, bn, bn, bn, bn);
+                        for(j=0; j<run->nhist; j++){
+                                fprintf(out, ",%s_h%d", bn, j);
+                        }
                 }
         }
+        fprintf(out, "\n");
+
+        for(i=0; i<list.n; i++){
+                char *base = strrchr(list.path[i], '/');
+                base = base == NULL ? list.path[i] : base+1;
+
+                if(0 != parse_acq_date(list.path[i], &year, &doy)){
+                        fprintf(stderr, "ERROR, no acquisition date in path of %s\n", base);
+                        nerr++;
+                        continue;
+                }
+                if(0 != subset_file(run, list.path[i], year, doy, tile, sensor, base)){
+                        fprintf(stderr, "ERROR, subsetting %s\n", base);
+                        nerr++;
+                }
+        }
+
+        if(out != stdout){
+                fclose(out);
+        }
+        fprintf(stderr, "Files subset = %d, failed = %d, from sidecar = %d\n", list.n-nerr, nerr, run->nsat);
+        fprintf(stderr, "Bytes requested = %lld, used = %lld, %s calls = %lld\n",
+                        run->io.nreq, run->io.nused, run->use_map ? "madvise" : "read", run->io.ncall);
+        if(run->use_zmap){
+                fprintf(stderr, "Zone map blocks built = %lld\n", run->nblock);
+        }
+        if(run->use_ovr){
+                fprintf(stderr, "Mode = overview, from pyramid = %d\n", run->novr);
+        }
+        free_file_list(&list);
+        return nerr > 0;
+}
 
+/* Sites of the polygons of file fpoly, one each, at the centroid of the
+ * first ring in lat/lon, or its vertex mean when the ring has no area.
+ */
+static int polygon_sites(char *fpoly, RUN *run)
+{
+        int i, j;
+
+        if(0 != read_polygons(fpoly, &run->poly, &run->nsite)){
+                return -1;
+        }
+        run->sites = (SITE *)calloc(run->nsite, sizeof(SITE));
+        if(run->sites == NULL){
+                free_polygons(run->poly, run->nsite);
+                return -1;
+        }
+        for(i=0; i<run->nsite; i++){
+                const POLYGON *pg = &run->poly[i];
+                SITE *st = &run->sites[i];
+                double a = 0, cy = 0, cx = 0, my = 0, mx = 0;
+                int n = pg->ring[1];
+                for(j=0; j<n; j++){
+                        const int k = j+1 < n ? j+1 : 0;
+                        double f = pg->lon[j]*pg->lat[k] - pg->lon[k]*pg->lat[j];
+                        a += f;
+                        cx += (pg->lon[j] + pg->lon[k]) * f;
+                        cy += (pg->lat[j] + pg->lat[k]) * f;
+                        mx += pg->lon[j];
+                        my += pg->lat[j];
+                }
+                strcpy(st->id, pg->id);
+                if(fabs(a) > 1e-15){
+                        st->lat = cy / (3*a);
+                        st->lon = cx / (3*a);
+                }
+                else{
+                        st->lat = my / n;
+                        st->lon = mx / n;
+                }
+                st->shape = FP_SQUARE;
+        }
         return 0;
 }
+
+int main(int argc, char *argv[])
+{
+        SITE one;
+        RUN run;
+
+        kernel_init(NULL);
+
+        memset(&run, 0, sizeof(RUN));
+        run.sites = &one;
+        run.nsite = 1;
+        run.use_map = 1;
+        run.use_sat = 1;
+        run.out = stdout;
+
+        if(argc > 1 && argv[1][0] != '-'){
+                if(argc < 10){
+                        usage();
+                        return 1;
+                }
+                one.id[0] = '\0';
+                one.lat = atof(argv[2]);
+                one.lon = atof(argv[3]);
+                one.window = atoi(argv[4]);
+                one.shape = FP_SQUARE;
+                return subset_file(&run, argv[1], atoi(argv[5]), atoi(argv[6]), argv[7], argv[8], argv[9]);
+        }
+
+        char *slat = NULL, *slon = NULL, *swin = NULL, *sdiam = NULL, *src = NULL, *fout = NULL, *fsite = NULL, *fpoly = NULL, *fgeo = NULL;
+        int nthread = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        double maxerr = 0;
+        char *pattern = "S2*albedo*.bin";
+        char *v;
+        int i, ret;
+
+        for(i=1; i<argc; i++){
+                if((v = opt_value(argc, argv, &i, NULL, "--lat")) != NULL){
+                        slat = v;
+                }
+                else if((v = opt_value(argc, argv, &i, NULL, "--lon")) != NULL){
+                        slon = v;
+                }
+                else if((v = opt_value(argc, argv, &i, "-w", "--window")) != NULL){
+                        swin = v;
+                }
+                else if((v = opt_value(argc, argv, &i, "-D", "--diameter")) != NULL){
+                        sdiam = v;
+                }
+                else if((v = opt_value(argc, argv, &i, "-d", "--directory")) != NULL){
+                        src = v;
+                }
+                else if((v = opt_value(argc, argv, &i, "-o", "--output")) != NULL){
+                        fout = v;
+                }
+                else if((v = opt_value(argc, argv, &i, "-p", "--pattern")) != NULL){
+                        pattern = v;
+                }
+                else if((v = opt_value(argc, argv, &i, "-s", "--sites")) != NULL){
+                        fsite = v;
+                }
+                else if((v = opt_value(argc, argv, &i, NULL, "--polygons")) != NULL){
+                        fpoly = v;
+                }
+                else if((v = opt_value(argc, argv, &i, NULL, "--geoloc")) != NULL){
+                        fgeo = v;
+                }
+                else if((v = opt_value(argc, argv, &i, NULL, "--threads")) != NULL){
+                        nthread = atoi(v);
+                        if(nthread < 1){
+                                printf("Bad thread count %s!\n", v);
+                                return 1;
+                        }
+                }
+                else if((v = opt_value(argc, argv, &i, NULL, "--max-error")) != NULL){
+                        maxerr = atof(v);
+                        if(!(maxerr >= 0)){
+                                printf("Bad error bound %s!\n", v);
+                                return 1;
+                        }
+                }
+                else if((v = opt_value(argc, argv, &i, NULL, "--warp")) != NULL){
+                        run.warp = atof(v);
+                        if(!(run.warp > 0)){
+                                printf("Bad warp cell size %s!\n", v);
+                                return 1;
+                        }
+                }
+                else if(strcmp(argv[i], "--pread") == 0){
+                        run.use_map = 0;
+                }
+                else if(strcmp(argv[i], "--zonemap") == 0){
+                        run.use_zmap = 1;
+                }
+                else if(strcmp(argv[i], "--zonemap-save") == 0){
+                        run.use_zmap = 1;
+                        run.save_zmap = 1;
+                }
+                else if(strcmp(argv[i], "--raw") == 0){
+                        run.use_sat = 0;
+                }
+                else if(strcmp(argv[i], "--build-sat") == 0){
+                        run.build_sat = 1;
+                }
+                else if((v = opt_value(argc, argv, &i, NULL, "--scl")) != NULL){
+                        run.scl = v;
+                }
+                else if(strcmp(argv[i], "--n2b") == 0){
+                        if(!run.use_n2b){
+                                n2b_default(&run.n2b);
+                        }
+                        run.use_n2b = 1;
+                }
+                else if((v = opt_value(argc, argv, &i, NULL, "--n2b-table")) != NULL){
+                        if(0 != n2b_read(v, &run.n2b)){
+                                return 1;
+                        }
+                        run.use_n2b = 1;
+                }
+                else if(strcmp(argv[i], "--area") == 0){
+                        run.area = 1;
+                }
+                else if(strcmp(argv[i], "--quantiles") == 0){
+                        run.use_dist = 1;
+                }
+                else if((v = opt_value(argc, argv, &i, NULL, "--hist")) != NULL){
+                        char c;
+                        if(3 != sscanf(v, "%lf,%lf,%d%c", &run.hlo, &run.hhi, &run.nhist, &c) || run.hhi <= run.hlo || run.nhist < 1 || run.nhist > DIST_MAX_HIST){
+                                printf("Bad histogram %s, <lo>,<hi>,<nbin> with lo < hi and at most %d bins!\n", v, DIST_MAX_HIST);
+                                return 1;
+                        }
+                        run.use_dist = 1;
+                }
+                else if(strcmp(argv[i], "--overview") == 0){
+                        run.use_ovr = 1;
+                }
+                else if(strcmp(argv[i], "--build-overview") == 0){
+                        run.build_ovr = 1;
+                }
+                else if(strcmp(argv[i], "--gctp") == 0){
+                        space_use_gctp(1);
+                }
+                else if(strcmp(argv[i], "--check-kernels") == 0){
+                        return kernel_check() == 0 ? 0 : 1;
+                }
+                else if(strcmp(argv[i], "--check-utm") == 0){
+                        return space_check() == 0 ? 0 : 1;
+                }
+                else if((v = opt_value(argc, argv, &i, NULL, "--kernel")) != NULL){
+                        if(0 != kernel_init(v)){
+                                fprintf(stderr, "KERNEL %s NOT AVAILABLE ON THIS CPU.\n", v);
+                                return 1;
+                        }
+                }
+                else{
+                        usage();
+                        return 1;
+                }
+        }
+
+        if(fgeo != NULL){
+                if(fout == NULL || (slat != NULL) != (slon != NULL) || (slat != NULL) != (swin != NULL) || src != NULL || fsite != NULL || fpoly != NULL || sdiam != NULL){
+                        printf("--geoloc takes -o and optionally --lat, --lon and -w, no -d, -s, -D or --polygons!\n");
+                        return 1;
+                }
+                // one grid for the whole list, the largest window
+                if(swin != NULL && 0 != parse_sizes(&run, swin, FP_SQUARE)){
+                        printf("Bad footprint size list %s, at most %d sizes!\n", swin, MAX_FOOTPRINT);
+                        return 1;
+                }
+                return geoloc_file(fgeo, fout, slat, slon, swin != NULL ? run.fpsize[run.nfp-1] : 0, nthread < 1 ? 1 : nthread, maxerr);
+        }
+        if(src != NULL && (run.build_sat || run.build_ovr)){
+                return build_batch(src, pattern, run.build_ovr);
+        }
+        if(fpoly != NULL && (fsite != NULL || slat != NULL || slon != NULL || swin != NULL || sdiam != NULL)){
+                printf("--polygons replaces the sites and footprints, no -s, --lat, --lon, -w or -D!\n");
+                return 1;
+        }
+        if(src == NULL || (swin != NULL && sdiam != NULL) || (fsite == NULL && fpoly == NULL && (slat == NULL || slon == NULL || (swin == NULL && sdiam == NULL)))){
+                printf("Missing required arguments!\n");
+                usage();
+                return 1;
+        }
+        if(fpoly != NULL && run.area){
+                printf("--area can not be combined with --polygons!\n");
+                return 1;
+        }
+        if(run.area && (run.scl != NULL || run.use_dist)){
+                printf("--area can not be combined with --scl, --quantiles or --hist!\n");
+                return 1;
+        }
+        if(run.warp > 0 && (fpoly != NULL || run.area || run.scl != NULL || run.use_dist)){
+                printf("--warp can not be combined with --polygons, --area, --scl, --quantiles or --hist!\n");
+                return 1;
+        }
+        if(run.use_n2b && run.scl == NULL){
+                printf("--n2b needs the SCL image, --scl!\n");
+                return 1;
+        }
+        if((swin != NULL && 0 != parse_sizes(&run, swin, FP_SQUARE)) || (sdiam != NULL && 0 != parse_sizes(&run, sdiam, FP_CIRCLE))){
+                printf("Bad footprint size list %s, at most %d sizes!\n", swin != NULL ? swin : sdiam, MAX_FOOTPRINT);
+                return 1;
+        }
+
+        if(fpoly != NULL){
+                if(0 != polygon_sites(fpoly, &run)){
+                        return 1;
+                }
+                run.multi = 1;
+                ret = run_batch(&run, src, pattern, fout);
+                free_polygons(run.poly, run.nsite);
+                free(run.sites);
+                return ret;
+        }
+        if(fsite != NULL){
+                if(0 != read_sites(fsite, &run.sites, &run.nsite)){
+                        return 1;
+                }
+                run.multi = 1;
+                ret = run_batch(&run, src, pattern, fout);
+                fp_free_cache(&run.fpc);
+                warp_free_cache(&run.wpc);
+                free(run.sites);
+                return ret;
+        }
+
+        one.id[0] = '\0';
+        one.lat = atof(slat);
+        one.lon = atof(slon);
+        one.window = run.fpsize[0];
+        one.shape = run.fpshape;
+        ret = run_batch(&run, src, pattern, fout);
+        fp_free_cache(&run.fpc);
+        warp_free_cache(&run.wpc);
+        return ret;
+}
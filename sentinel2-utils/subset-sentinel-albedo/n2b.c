@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "n2b.h"
+
+// column names of the classes, and the names the table file knows them by
+static const char *cname[SCL_NCLASS] = {"nodata", "free", "cloud", "snow"};
+static const char *tname[SCL_NCLASS] = {"nodata", "snow_free", "cloud", "snow"};
+
+const char *n2b_class_name(int cls)
+{
+	return cname[cls];
+}
+
+/* Shortwave sets of getN2B in subset_sentinel2_sr.py, for bands 02, 03,
+ * 04, 8A, 11 and 12 in that order.
+ */
+void n2b_default(N2B *t)
+{
+	static const double clear[7] = {0.2687617, 0.0361839, 0.1501418, 0.3044542, 0.164433, 0.0356021, -0.0048673};
+	static const double snow[7] = {-0.1992158, 2.300191, -0.1912122, 0.6714989, -2.272847, 1.934139, -0.0001144};
+
+	memset(t, 0, sizeof(N2B));
+	t->nband = 6;
+	t->set[SCL_CLEAR] = 1;
+	t->set[SCL_SNOW] = 1;
+	memcpy(t->coef[SCL_CLEAR], clear, sizeof(clear));
+	memcpy(t->coef[SCL_SNOW], snow, sizeof(snow));
+}
+
+/* Coefficient table, one class per line: the class name (snow_free,
+ * snow, cloud or nodata), a weight per band in file band order and the
+ * constant, blank separated. Lines starting with '#' are skipped; all
+ * lines give the same number of bands.
+ */
+int n2b_read(char *fname, N2B *t)
+{
+	FILE *fp = fopen(fname, "r");
+	char line[1024], name[32];
+	int nline = 0, k, n, pos;
+	double c[N2B_MAX_BAND+2];
+
+	if(fp == NULL){
+		fprintf(stderr, "CAN NOT OPEN N2B TABLE %s\n", fname);
+		return -1;
+	}
+	memset(t, 0, sizeof(N2B));
+
+	while(fgets(line, sizeof(line), fp) != NULL){
+		char *p = line + strspn(line, " \t");
+		nline++;
+		line[strcspn(line, "\r\n")] = '\0';
+		if(*p == '\0' || *p == '#' || 1 != sscanf(p, "%31s%n", name, &pos)){
+			continue;
+		}
+		for(k=0; k<SCL_NCLASS && strcmp(name, tname[k]) != 0; k++);
+		for(n=0, p+=pos; n<N2B_MAX_BAND+2 && 1 == sscanf(p, " %lf%n", &c[n], &pos); n++, p+=pos);
+		if(k == SCL_NCLASS || n < 2 || n > N2B_MAX_BAND+1 || (t->nband > 0 && n-1 != t->nband)){
+			fprintf(stderr, "BAD N2B TABLE LINE %d: %s\n", nline, line);
+			fclose(fp);
+			return -1;
+		}
+		t->nband = n-1;
+		t->set[k] = 1;
+		memcpy(t->coef[k], c, n*sizeof(double));
+	}
+	fclose(fp);
+	if(t->nband == 0){
+		fprintf(stderr, "NO COEFFICIENTS IN N2B TABLE %s\n", fname);
+		return -1;
+	}
+	return 0;
+}
+
+/* Coefficients on the stored values of an image whose reflectance in
+ * band b is gain[b] * value + offset[b], so the kernels take the values
+ * as read.
+ */
+void n2b_fold(const N2B *t, const double *gain, const double *offset, N2B *e)
+{
+	int k, b;
+
+	*e = *t;
+	for(k=0; k<SCL_NCLASS; k++){
+		for(b=0; b<t->nband; b++){
+			e->coef[k][b] = t->coef[k][b] * gain[b];
+			e->coef[k][t->nband] += t->coef[k][b] * offset[b];
+		}
+	}
+}
@@ -0,0 +1,23 @@
+#ifndef __INC_N2B_H
+#define __INC_N2B_H
+
+#include "scl.h"
+
+#define N2B_MAX_BAND (16)
+
+/* Narrow-to-broadband coefficients per SCL class: nband band weights and
+ * a constant, for the classes with set. A pixel of a class without a set
+ * gives no broadband value.
+ */
+typedef struct{
+	int nband;
+	int set[SCL_NCLASS];
+	double coef[SCL_NCLASS][N2B_MAX_BAND+1];
+}N2B;
+
+void n2b_default(N2B *t);
+int n2b_read(char *fname, N2B *t);
+void n2b_fold(const N2B *t, const double *gain, const double *offset, N2B *e);
+const char *n2b_class_name(int cls);
+
+#endif
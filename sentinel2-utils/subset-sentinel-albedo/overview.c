@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "overview.h"
+#include "raster.h"
+
+static void ov_header(OV_HDR *h, ENVI_HDR *envi, const NODATA *nd, struct stat *st, int nlevel)
+{
+	memset(h, 0, sizeof(OV_HDR));
+	memcpy(h->magic, OV_MAGIC, sizeof(h->magic));
+	h->nrow = envi->nrow;
+	h->ncol = envi->ncol;
+	h->nband = envi->nband;
+	h->dtype = envi->dtype;
+	h->byteorder = envi->byteorder;
+	h->ndset = nd->set;
+	h->ndvalue = nd->set ? nd->value : 0;
+	h->hoffset = envi->hoffset;
+	h->src_size = st->st_size;
+	h->src_mtime = st->st_mtim.tv_sec;
+	h->src_mtime_ns = st->st_mtim.tv_nsec;
+	h->nlevel = nlevel;
+}
+
+/* Level grids up to the first level of one cell, or OV_MAX_LEVEL, and the
+ * file size; cells are set once the file is mapped.
+ */
+static void ov_layout(OVERVIEW *ov, ENVI_HDR *envi)
+{
+	long long size = sizeof(OV_HDR);
+	int l;
+
+	memset(ov, 0, sizeof(OVERVIEW));
+	ov->nrow = envi->nrow;
+	ov->ncol = envi->ncol;
+	ov->nband = envi->nband;
+	for(l=OV_MIN_LEVEL; l<=OV_MAX_LEVEL; l++){
+		ov->ny[l] = (int)(((long long)envi->nrow + (1LL<<l) - 1) >> l);
+		ov->nx[l] = (int)(((long long)envi->ncol + (1LL<<l) - 1) >> l);
+		size += (long long)ov->ny[l] * ov->nx[l] * ov->nband * sizeof(MOMENT);
+		ov->top = l;
+		if(ov->ny[l] == 1 && ov->nx[l] == 1){
+			break;
+		}
+	}
+	ov->size = size;
+}
+
+static void ov_cells(OVERVIEW *ov)
+{
+	char *p = ov->map + sizeof(OV_HDR);
+	int l;
+
+	for(l=OV_MIN_LEVEL; l<=ov->top; l++){
+		ov->cell[l] = (MOMENT *)p;
+		p += (long long)ov->ny[l] * ov->nx[l] * ov->nband * sizeof(MOMENT);
+	}
+}
+
+/* Write the pyramid of image fenvi: the finest level from the pixels,
+ * OV_MIN_LEVEL rows at a time through the data type's kernel, each
+ * coarser level by merging the one below. Built in a mapping under a
+ * temporary name and renamed when complete.
+ */
+int ov_build(char *fenvi, ENVI_HDR *envi, PIX_FN kfn, const NODATA *nd)
+{
+	int cs = 1 << OV_MIN_LEVEL;
+	char name[4096], tmp[4104];
+	char *row = NULL;
+	RSPAN *span = NULL;
+	OVERVIEW ov;
+	OV_HDR h;
+	RASTER ras;
+	struct stat st;
+	long bstride;
+	int fd = -1, ret = -1;
+	int l, r, cy, cx, b, k, nspan;
+
+	memset(&ras, 0, sizeof(RASTER));
+	ras.fd = -1;
+	ov_layout(&ov, envi);
+	snprintf(name, sizeof(name), "%s%s", fenvi, OV_SUFFIX);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+
+	if(stat(fenvi, &st) != 0 || 0 != raster_open(&ras, fenvi, 0) || 0 != raster_layout(&ras, envi)){
+		fprintf(stderr, "CAN NOT OPEN %s\n", fenvi);
+		goto done;
+	}
+	if(ras.size < ras.hoffset + (long long)ras.dsize*envi->nrow*envi->ncol*envi->nband){
+		fprintf(stderr, "FILE SHORTER THAN HEADER SAYS. %s\n", fenvi);
+		goto done;
+	}
+	row = (char *)malloc((long)envi->ncol*envi->nband*ras.dsize);
+	span = (RSPAN *)malloc(envi->nband*sizeof(RSPAN));
+	if(row == NULL || span == NULL){
+		goto done;
+	}
+
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0 || 0 != ftruncate(fd, (off_t)ov.size)){
+		fprintf(stderr, "CAN NOT WRITE %s\n", tmp);
+		goto done;
+	}
+	ov.map = (char *)mmap(NULL, (size_t)ov.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(ov.map == (char *)MAP_FAILED){
+		ov.map = NULL;
+		goto done;
+	}
+	ov_cells(&ov);
+
+	for(l=OV_MIN_LEVEL; l<=ov.top; l++){
+		for(k=0; k<ov.ny[l]*ov.nx[l]*ov.nband; k++){
+			moment_init(&ov.cell[l][k]);
+		}
+	}
+
+	for(r=0; r<envi->nrow; r++){
+		nspan = raster_row_spans(&ras, r, 0, envi->ncol-1, row, span);
+		if(0 != raster_readv(&ras, span, nspan)){
+			fprintf(stderr, "READ FAILED. row %d\n", r);
+			goto done;
+		}
+		char *p = raster_row(&ras, r, row, &bstride);
+		MOMENT *m = ov.cell[OV_MIN_LEVEL] + (long)(r >> OV_MIN_LEVEL)*ov.nx[OV_MIN_LEVEL]*ov.nband;
+		for(cx=0; cx<ov.nx[OV_MIN_LEVEL]; cx++){
+			int c = cx * cs;
+			int n = c + cs < envi->ncol ? cs : envi->ncol - c;
+			long off = envi->il == ENVI_BIP ? (long)c*envi->nband : c;
+			kfn(p + off*ras.dsize, n, envi->nband, bstride, nd, m + (long)cx*ov.nband);
+		}
+	}
+
+	for(l=OV_MIN_LEVEL+1; l<=ov.top; l++){
+		for(cy=0; cy<ov.ny[l]; cy++){
+			for(cx=0; cx<ov.nx[l]; cx++){
+				MOMENT *m = ov.cell[l] + ((long)cy*ov.nx[l] + cx)*ov.nband;
+				for(k=0; k<4; k++){
+					int y = 2*cy + k/2, x = 2*cx + k%2;
+					if(y >= ov.ny[l-1] || x >= ov.nx[l-1]){
+						continue;
+					}
+					const MOMENT *s = ov.cell[l-1] + ((long)y*ov.nx[l-1] + x)*ov.nband;
+					for(b=0; b<ov.nband; b++){
+						moment_merge(&m[b], &s[b]);
+					}
+				}
+			}
+		}
+	}
+
+	ov_header(&h, envi, nd, &st, ov.top - OV_MIN_LEVEL + 1);
+	memcpy(ov.map, &h, sizeof(OV_HDR));
+	if(0 != msync(ov.map, (size_t)ov.size, MS_SYNC)){
+		goto done;
+	}
+	if(0 != rename(tmp, name)){
+		goto done;
+	}
+	ret = 0;
+
+done:
+	if(ov.map != NULL){
+		munmap(ov.map, (size_t)ov.size);
+	}
+	if(fd >= 0){
+		close(fd);
+	}
+	if(ret != 0){
+		unlink(tmp);
+	}
+	raster_close(&ras);
+	free(row);
+	free(span);
+	return ret;
+}
+
+/* Map the pyramid of fenvi if it was built from the image as it is now.
+ * Returns -1 when it is missing or stale, and the caller reads pixels.
+ */
+int ov_open(OVERVIEW *ov, char *fenvi, ENVI_HDR *envi, const NODATA *nd)
+{
+	char name[4096];
+	struct stat st;
+	OV_HDR h;
+	int fd;
+
+	ov_layout(ov, envi);
+	if(stat(fenvi, &st) != 0){
+		return -1;
+	}
+	ov_header(&h, envi, nd, &st, ov->top - OV_MIN_LEVEL + 1);
+
+	snprintf(name, sizeof(name), "%s%s", fenvi, OV_SUFFIX);
+	fd = open(name, O_RDONLY);
+	if(fd < 0){
+		return -1;
+	}
+	if(fstat(fd, &st) != 0 || st.st_size != ov->size){
+		close(fd);
+		return -1;
+	}
+	ov->map = (char *)mmap(NULL, (size_t)ov->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(ov->map == (char *)MAP_FAILED){
+		ov->map = NULL;
+		return -1;
+	}
+	if(0 != memcmp(ov->map, &h, sizeof(OV_HDR))){
+		ov_close(ov);
+		return -1;
+	}
+	ov_cells(ov);
+	return 0;
+}
+
+void ov_close(OVERVIEW *ov)
+{
+	if(ov->map != NULL){
+		munmap(ov->map, (size_t)ov->size);
+	}
+	ov->map = NULL;
+}
+
+// nband moments of cell (cy, cx) of a level
+const MOMENT *ov_cell(const OVERVIEW *ov, int level, int cy, int cx)
+{
+	return ov->cell[level] + ((long)cy*ov->nx[level] + cx)*ov->nband;
+}
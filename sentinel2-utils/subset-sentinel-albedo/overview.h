@@ -0,0 +1,55 @@
+#ifndef __INC_OVERVIEW_H
+#define __INC_OVERVIEW_H
+
+#include "envi.h"
+#include "stats.h"
+#include "kernel.h"
+
+#define OV_MAGIC "S2OVR001"
+#define OV_SUFFIX ".ovr"
+// finest level: cells of 8x8 pixels
+#define OV_MIN_LEVEL (3)
+#define OV_MAX_LEVEL (15)
+
+/* Overview pyramid <image>.ovr: for levels OV_MIN_LEVEL.. each aligned
+ * 2^level square cell of the image (clipped at the right and bottom
+ * edges) holds one moment per band of its valid values, so any cell
+ * merges exactly into a window. Level l+1 is built by merging the four
+ * level l cells below it. Kept with the image size, mtime, layout and
+ * nodata it was built from, as the other sidecars.
+ */
+typedef struct{
+	char magic[8];
+	int nrow;
+	int ncol;
+	int nband;
+	int dtype;
+	int byteorder;
+	int ndset;
+	double ndvalue;
+	long long hoffset;
+	long long src_size;
+	long long src_mtime;
+	long long src_mtime_ns;
+	int nlevel;
+	int pad;
+}OV_HDR;
+
+typedef struct{
+	char *map;
+	long long size;
+	int nrow;
+	int ncol;
+	int nband;
+	int top;				// coarsest level
+	int ny[OV_MAX_LEVEL+1];
+	int nx[OV_MAX_LEVEL+1];
+	MOMENT *cell[OV_MAX_LEVEL+1];	// ny*nx*nband per level
+}OVERVIEW;
+
+int ov_build(char *fenvi, ENVI_HDR *envi, PIX_FN kfn, const NODATA *nd);
+int ov_open(OVERVIEW *ov, char *fenvi, ENVI_HDR *envi, const NODATA *nd);
+void ov_close(OVERVIEW *ov);
+const MOMENT *ov_cell(const OVERVIEW *ov, int level, int cy, int cx);
+
+#endif
@@ -0,0 +1,603 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "polygon.h"
+
+// growing vertex and ring lists of the polygon being read
+static int poly_add_point(POLYGON *pg, int *cap, double lon, double lat)
+{
+	if(pg->npt == *cap){
+		int n = *cap > 0 ? *cap*2 : 64;
+		double *a = (double *)realloc(pg->lat, n*sizeof(double));
+		double *b = a == NULL ? NULL : (double *)realloc(pg->lon, n*sizeof(double));
+		if(a != NULL){
+			pg->lat = a;
+		}
+		if(b == NULL){
+			return -1;
+		}
+		pg->lon = b;
+		*cap = n;
+	}
+	pg->lat[pg->npt] = lat;
+	pg->lon[pg->npt] = lon;
+	pg->npt++;
+	return 0;
+}
+
+// close the ring of the points added since the last one, if it has any
+static int poly_end_ring(POLYGON *pg)
+{
+	int *p;
+
+	if(pg->npt == (pg->nring > 0 ? pg->ring[pg->nring] : 0)){
+		return 0;
+	}
+	p = (int *)realloc(pg->ring, (pg->nring+2)*sizeof(int));
+	if(p == NULL){
+		return -1;
+	}
+	pg->ring = p;
+	if(pg->nring == 0){
+		pg->ring[0] = 0;
+	}
+	pg->nring++;
+	pg->ring[pg->nring] = pg->npt;
+	return 0;
+}
+
+static void poly_clear(POLYGON *pg)
+{
+	free(pg->lat);
+	free(pg->lon);
+	free(pg->ring);
+	memset(pg, 0, sizeof(POLYGON));
+}
+
+/* POLYGON ((lon lat, ...), (...)) or MULTIPOLYGON (((...)), ((...))):
+ * each innermost parenthesis is a ring.
+ */
+static int parse_wkt(char *p, POLYGON *pg)
+{
+	int cap = 0, depth = 0;
+	char *end;
+
+	while(*p != '\0' && *p != '('){
+		p++;
+	}
+	while(*p != '\0'){
+		if(*p == '('){
+			depth++;
+			p++;
+		}
+		else if(*p == ')'){
+			if(0 != poly_end_ring(pg)){
+				return -1;
+			}
+			depth--;
+			p++;
+		}
+		else if(*p == ',' || isspace((unsigned char)*p)){
+			p++;
+		}
+		else{
+			double lon = strtod(p, &end), lat;
+			if(end == p || depth == 0){
+				return -1;
+			}
+			p = end;
+			lat = strtod(p, &end);
+			if(end == p || 0 != poly_add_point(pg, &cap, lon, lat)){
+				return -1;
+			}
+			p = end;
+			// a third coordinate (Z) is ignored
+			while(*p == ' ' || *p == '\t'){
+				p++;
+			}
+			if(*p != ',' && *p != ')'){
+				strtod(p, &end);
+				p = end;
+			}
+		}
+	}
+	return depth == 0 && pg->nring > 0 ? 0 : -1;
+}
+
+/* Minimal JSON reading for GeoJSON: values are skipped unless they are
+ * the keys a feature needs.
+ */
+static char *json_ws(char *p)
+{
+	while(isspace((unsigned char)*p)){
+		p++;
+	}
+	return p;
+}
+
+// string at p into s (at most n-1 characters, escapes taken literally)
+static char *json_string(char *p, char *s, int n)
+{
+	int i = 0;
+
+	if(*p != '"'){
+		return NULL;
+	}
+	for(p++; *p != '\0' && *p != '"'; p++){
+		if(*p == '\\' && p[1] != '\0'){
+			p++;
+		}
+		if(i < n-1){
+			s[i++] = *p;
+		}
+	}
+	s[i] = '\0';
+	return *p == '"' ? p+1 : NULL;
+}
+
+static char *json_skip(char *p)
+{
+	char tmp[8];
+	int depth = 0;
+
+	p = json_ws(p);
+	if(*p == '"'){
+		return json_string(p, tmp, sizeof(tmp));
+	}
+	if(*p != '{' && *p != '['){
+		while(*p != '\0' && *p != ',' && *p != '}' && *p != ']'){
+			p++;
+		}
+		return p;
+	}
+	for(; *p != '\0'; p++){
+		if(*p == '"'){
+			p = json_string(p, tmp, sizeof(tmp));
+			if(p == NULL){
+				return NULL;
+			}
+			p--;
+		}
+		else if(*p == '{' || *p == '['){
+			depth++;
+		}
+		else if(*p == '}' || *p == ']'){
+			if(--depth == 0){
+				return p+1;
+			}
+		}
+	}
+	return NULL;
+}
+
+/* GeoJSON coordinates of a Polygon or MultiPolygon: the innermost arrays
+ * of numbers are positions, an array of positions is a ring. *pos is set
+ * when the array at p is a position.
+ */
+static char *json_coords(char *p, POLYGON *pg, int *cap, int *pos)
+{
+	char *end;
+	int child = 0;
+
+	p = json_ws(p);
+	if(*p != '['){
+		return NULL;
+	}
+	p = json_ws(p+1);
+	*pos = *p == '-' || *p == '.' || isdigit((unsigned char)*p);
+	if(*pos){
+		double v[2];
+		int n = 0;
+		while(*p != ']'){
+			double x = strtod(p, &end);
+			if(end == p){
+				return NULL;
+			}
+			if(n < 2){
+				v[n] = x;
+			}
+			n++;
+			p = json_ws(end);
+			if(*p == ','){
+				p = json_ws(p+1);
+			}
+		}
+		if(n < 2 || 0 != poly_add_point(pg, cap, v[0], v[1])){
+			return NULL;
+		}
+		return p+1;
+	}
+	while(*p != ']'){
+		p = json_coords(p, pg, cap, &child);
+		if(p == NULL){
+			return NULL;
+		}
+		p = json_ws(p);
+		if(*p == ','){
+			p = json_ws(p+1);
+		}
+	}
+	if(child && 0 != poly_end_ring(pg)){
+		return NULL;
+	}
+	return p+1;
+}
+
+/* One object: a FeatureCollection's features, a Feature's geometry named
+ * by its id or that of its properties, or a Polygon or MultiPolygon added
+ * to the list under the name id. Names found in the object are handed up
+ * in id when it is empty.
+ */
+static char *json_object(char *p, POLYGON **list, int *n, int *cap, char *id)
+{
+	char key[32], type[32] = "", fid[64] = "", pid[64] = "";
+	char *coords = NULL, *geom = NULL;
+
+	p = json_ws(p);
+	if(*p != '{'){
+		return NULL;
+	}
+	p = json_ws(p+1);
+	while(*p != '}'){
+		p = json_string(p, key, sizeof(key));
+		if(p == NULL || *(p = json_ws(p)) != ':'){
+			return NULL;
+		}
+		p = json_ws(p+1);
+		if(strcmp(key, "type") == 0){
+			p = json_string(p, type, sizeof(type));
+		}
+		else if(strcmp(key, "id") == 0 || ((strcmp(key, "name") == 0 || strcmp(key, "Site_ID") == 0) && fid[0] == '\0')){
+			if(*p == '"'){
+				p = json_string(p, fid, sizeof(fid));
+			}
+			else{
+				char *e = json_skip(p);
+				if(e != NULL){
+					snprintf(fid, sizeof(fid), "%.*s", (int)(e - p), p);
+				}
+				p = e;
+			}
+		}
+		else if(strcmp(key, "features") == 0 && *p == '['){
+			p = json_ws(p+1);
+			while(p != NULL && *p != ']'){
+				p = json_object(p, list, n, cap, NULL);
+				if(p != NULL && *(p = json_ws(p)) == ','){
+					p = json_ws(p+1);
+				}
+			}
+			p = p == NULL ? NULL : p+1;
+		}
+		else if(strcmp(key, "properties") == 0 && *p == '{'){
+			p = json_object(p, list, n, cap, pid);
+		}
+		else if(strcmp(key, "geometry") == 0 && *p == '{'){
+			geom = p;
+			p = json_skip(p);
+		}
+		else if(strcmp(key, "coordinates") == 0){
+			coords = p;
+			p = json_skip(p);
+		}
+		else{
+			p = json_skip(p);
+		}
+		if(p == NULL){
+			return NULL;
+		}
+		p = json_ws(p);
+		if(*p == ','){
+			p = json_ws(p+1);
+		}
+	}
+	if(fid[0] == '\0'){
+		strcpy(fid, pid);
+	}
+	if(id != NULL && id[0] == '\0'){
+		strcpy(id, fid);
+	}
+
+	if(geom != NULL && NULL == json_object(geom, list, n, cap, fid)){
+		return NULL;
+	}
+	if(coords != NULL && (strcmp(type, "Polygon") == 0 || strcmp(type, "MultiPolygon") == 0)){
+		POLYGON pg;
+		int pcap = 0, pos;
+		memset(&pg, 0, sizeof(POLYGON));
+		if(*n == *cap){
+			int c = *cap > 0 ? *cap*2 : 64;
+			POLYGON *q = (POLYGON *)realloc(*list, c*sizeof(POLYGON));
+			if(q == NULL){
+				return NULL;
+			}
+			*list = q;
+			*cap = c;
+		}
+		if(NULL == json_coords(coords, &pg, &pcap, &pos) || pg.nring == 0){
+			poly_clear(&pg);
+			return NULL;
+		}
+		if(id != NULL && id[0] != '\0'){
+			snprintf(pg.id, sizeof(pg.id), "%s", id);
+		}
+		else{
+			snprintf(pg.id, sizeof(pg.id), "%d", *n + 1);
+		}
+		(*list)[(*n)++] = pg;
+	}
+	return p+1;
+}
+
+static char *read_all(char *fname)
+{
+	FILE *fp = fopen(fname, "rb");
+	char *buf;
+	long n;
+
+	if(fp == NULL){
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	n = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	buf = (char *)malloc(n+1);
+	if(buf != NULL && (long)fread(buf, 1, n, fp) != n){
+		free(buf);
+		buf = NULL;
+	}
+	if(buf != NULL){
+		buf[n] = '\0';
+	}
+	fclose(fp);
+	return buf;
+}
+
+/* Site polygons from a GeoJSON file (a FeatureCollection, Feature or
+ * bare geometry of Polygons and MultiPolygons, id from the feature "id"
+ * or its "id", "name" or "Site_ID" property), or from a text file of
+ * "id,WKT" lines; '#' lines and a header line without WKT are skipped.
+ */
+int read_polygons(char *fname, POLYGON **poly, int *npoly)
+{
+	char *buf = read_all(fname);
+	char *p, *line, *next;
+	POLYGON *list = NULL;
+	int n = 0, cap = 0, nline = 0;
+
+	if(buf == NULL){
+		fprintf(stderr, "CAN NOT OPEN POLYGON FILE %s\n", fname);
+		return -1;
+	}
+	p = json_ws(buf);
+	if(*p == '{'){
+		char id[64] = "";
+		if(NULL == json_object(p, &list, &n, &cap, id)){
+			fprintf(stderr, "BAD GEOJSON %s\n", fname);
+			free_polygons(list, n);
+			free(buf);
+			return -1;
+		}
+	}
+	else{
+		for(line=buf; line!=NULL; line=next){
+			POLYGON pg;
+			char *wkt;
+			next = strchr(line, '\n');
+			if(next != NULL){
+				*next++ = '\0';
+			}
+			nline++;
+			line[strcspn(line, "\r")] = '\0';
+			line = json_ws(line);
+			if(*line == '\0' || *line == '#'){
+				continue;
+			}
+			wkt = line + strcspn(line, ",\t");
+			if(*wkt == '\0' || strchr(wkt, '(') == NULL){
+				if(n == 0 && nline == 1){
+					continue;
+				}
+				fprintf(stderr, "BAD POLYGON LINE %d\n", nline);
+				free_polygons(list, n);
+				free(buf);
+				return -1;
+			}
+			*wkt++ = '\0';
+			memset(&pg, 0, sizeof(POLYGON));
+			snprintf(pg.id, sizeof(pg.id), "%s", line);
+			if(0 != parse_wkt(wkt, &pg)){
+				fprintf(stderr, "BAD WKT ON LINE %d\n", nline);
+				poly_clear(&pg);
+				free_polygons(list, n);
+				free(buf);
+				return -1;
+			}
+			if(n == cap){
+				cap = cap > 0 ? cap*2 : 64;
+				POLYGON *q = (POLYGON *)realloc(list, cap*sizeof(POLYGON));
+				if(q == NULL){
+					poly_clear(&pg);
+					free_polygons(list, n);
+					free(buf);
+					return -1;
+				}
+				list = q;
+			}
+			list[n++] = pg;
+		}
+	}
+	free(buf);
+	if(n == 0){
+		fprintf(stderr, "NO POLYGON IN %s\n", fname);
+		free(list);
+		return -1;
+	}
+	*poly = list;
+	*npoly = n;
+	return 0;
+}
+
+void free_polygons(POLYGON *poly, int npoly)
+{
+	int i;
+
+	for(i=0; i<npoly; i++){
+		poly_clear(&poly[i]);
+	}
+	free(poly);
+}
+
+// a polygon edge from row first on, x at the centre of that row and per row
+typedef struct{
+	int first;
+	int last;
+	double x;
+	double dx;
+}EDGE;
+
+static int cmp_edge(const void *a, const void *b)
+{
+	return ((const EDGE *)a)->first - ((const EDGE *)b)->first;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : (x > y);
+}
+
+/* Rasterize rings of vertices (y, x) in continuous pixel coordinates, row
+ * r spanning y in [r, r+1), with an edge list: edges sorted by their first
+ * row enter the active list as the scanline reaches them and leave after
+ * their last; each row pairs the sorted crossings of the active edges at
+ * the pixel centre line. A pixel is in when its centre is, by the
+ * even-odd rule. Returns -1 when no pixel is.
+ */
+int poly_rasterize(const double *y, const double *x, const int *ring, int nring, POLY_SPANS *sp)
+{
+	EDGE *edge = (EDGE *)malloc(ring[nring]*sizeof(EDGE));
+	EDGE *act = (EDGE *)malloc(ring[nring]*sizeof(EDGE));
+	double *xs = (double *)malloc(ring[nring]*sizeof(double));
+	int ne = 0, na = 0, next = 0, cap = 0, nrun = 0;
+	int i, j, k, r;
+
+	memset(sp, 0, sizeof(POLY_SPANS));
+	if(edge == NULL || act == NULL || xs == NULL){
+		goto fail;
+	}
+	for(k=0; k<nring; k++){
+		for(i=ring[k]; i<ring[k+1]; i++){
+			j = i+1 < ring[k+1] ? i+1 : ring[k];
+			double y0 = y[i], y1 = y[j], x0 = x[i], x1 = x[j];
+			if(y0 == y1){
+				continue;
+			}
+			if(y0 > y1){
+				double t = y0; y0 = y1; y1 = t;
+				t = x0; x0 = x1; x1 = t;
+			}
+			// rows whose centre line r+0.5 lies in [y0, y1)
+			EDGE *e = &edge[ne];
+			e->first = (int)ceil(y0 - 0.5);
+			e->last = (int)ceil(y1 - 0.5) - 1;
+			if(e->last < e->first){
+				continue;
+			}
+			e->dx = (x1 - x0) / (y1 - y0);
+			e->x = x0 + (e->first + 0.5 - y0) * e->dx;
+			ne++;
+		}
+	}
+	if(ne == 0){
+		goto fail;
+	}
+	qsort(edge, ne, sizeof(EDGE), cmp_edge);
+	sp->r1 = edge[0].first;
+	sp->r2 = edge[0].last;
+	for(i=1; i<ne; i++){
+		if(edge[i].last > sp->r2){
+			sp->r2 = edge[i].last;
+		}
+	}
+	sp->rs = (int *)malloc((sp->r2 - sp->r1 + 2)*sizeof(int));
+	if(sp->rs == NULL){
+		goto fail;
+	}
+	sp->c1 = 0;
+	sp->c2 = -1;
+
+	for(r=sp->r1; r<=sp->r2; r++){
+		sp->rs[r - sp->r1] = nrun;
+		while(next < ne && edge[next].first == r){
+			act[na++] = edge[next++];
+		}
+		for(i=0, j=0; i<na; i++){
+			if(act[i].last >= r){
+				act[j++] = act[i];
+			}
+		}
+		na = j;
+		for(i=0; i<na; i++){
+			xs[i] = act[i].x;
+			act[i].x += act[i].dx;
+		}
+		qsort(xs, na, sizeof(double), cmp_double);
+
+		int n0 = nrun;
+		for(i=0; i+1<na; i+=2){
+			// columns whose centre c+0.5 lies in [xs[i], xs[i+1])
+			int cs = (int)ceil(xs[i] - 0.5);
+			int ce = (int)ceil(xs[i+1] - 0.5) - 1;
+			if(ce < cs){
+				continue;
+			}
+			if(nrun == cap){
+				cap = cap > 0 ? cap*2 : 64;
+				int *p = (int *)realloc(sp->run, 2*cap*sizeof(int));
+				if(p == NULL){
+					goto fail;
+				}
+				sp->run = p;
+			}
+			if(sp->c2 < sp->c1){
+				sp->c1 = cs;
+				sp->c2 = ce;
+			}
+			sp->c1 = cs < sp->c1 ? cs : sp->c1;
+			sp->c2 = ce > sp->c2 ? ce : sp->c2;
+			sp->run[2*nrun] = cs;
+			sp->run[2*nrun+1] = ce;
+			nrun++;
+		}
+		if(nrun - n0 > sp->maxrun){
+			sp->maxrun = nrun - n0;
+		}
+	}
+	sp->rs[sp->r2 - sp->r1 + 1] = nrun;
+	free(edge);
+	free(act);
+	free(xs);
+	if(nrun == 0){
+		poly_spans_free(sp);
+		return -1;
+	}
+	return 0;
+
+fail:
+	free(edge);
+	free(act);
+	free(xs);
+	poly_spans_free(sp);
+	return -1;
+}
+
+void poly_spans_free(POLY_SPANS *sp)
+{
+	free(sp->rs);
+	free(sp->run);
+	sp->rs = NULL;
+	sp->run = NULL;
+}
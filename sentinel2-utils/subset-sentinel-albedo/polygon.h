@@ -0,0 +1,35 @@
+#ifndef __INC_POLYGON_H
+#define __INC_POLYGON_H
+
+/* A site polygon in lat/lon: its rings, outer boundaries and holes alike,
+ * as consecutive vertex runs; the pixels inside are those inside an odd
+ * number of rings. A multipolygon is the rings of all its parts.
+ */
+typedef struct{
+	char id[64];
+	int npt;
+	int nring;
+	double *lat;
+	double *lon;
+	int *ring;		// nring+1 offsets into the vertices
+}POLYGON;
+
+/* Rows r1..r2 of a rasterized polygon: row r has the inclusive column
+ * pairs run[2*rs[r-r1]] .. run[2*rs[r-r1+1]-1], left to right.
+ */
+typedef struct{
+	int r1;
+	int r2;
+	int c1;
+	int c2;
+	int *rs;
+	int *run;
+	int maxrun;		// most runs in one row
+}POLY_SPANS;
+
+int read_polygons(char *fname, POLYGON **poly, int *npoly);
+void free_polygons(POLYGON *poly, int npoly);
+int poly_rasterize(const double *y, const double *x, const int *ring, int nring, POLY_SPANS *sp);
+void poly_spans_free(POLY_SPANS *sp);
+
+#endif
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "raster.h"
+#include "kernel.h"
+
+int raster_open(RASTER *ras, char *fname, int use_map)
+{
+	struct stat st;
+
+	memset(ras, 0, sizeof(RASTER));
+	ras->fd = open(fname, O_RDONLY);
+	if(ras->fd < 0){
+		return -1;
+	}
+	if(fstat(ras->fd, &st) == 0){
+		ras->size = st.st_size;
+	}
+
+	// fall back to reads if the file can not be mapped
+	if(use_map && ras->size > 0 && (unsigned long long)ras->size <= (size_t)-1){
+		void *p = mmap(NULL, (size_t)ras->size, PROT_READ, MAP_SHARED, ras->fd, 0);
+		if(p != MAP_FAILED){
+			ras->map = (char *)p;
+			// windows touch scattered spans, kernel readahead only wastes I/O
+			madvise(ras->map, (size_t)ras->size, MADV_RANDOM);
+		}
+	}
+
+	ras->gap = (char *)malloc(RASTER_MERGE_GAP);
+	if(ras->gap == NULL){
+		close(ras->fd);
+		ras->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+void raster_close(RASTER *ras)
+{
+	if(ras->map != NULL){
+		munmap(ras->map, (size_t)ras->size);
+	}
+	if(ras->fd >= 0){
+		close(ras->fd);
+	}
+	free(ras->gap);
+	ras->fd = -1;
+	ras->gap = NULL;
+	ras->map = NULL;
+}
+
+// preadv until all of iov is filled, or fail at end of file
+static int preadv_full(int fd, struct iovec *iov, int niov, long long off)
+{
+	while(niov > 0){
+		ssize_t got = preadv(fd, iov, niov, (off_t)off);
+		if(got < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		if(got == 0){
+			return -1;
+		}
+		off += got;
+		while(niov > 0 && (size_t)got >= iov->iov_len){
+			got -= iov->iov_len;
+			iov++;
+			niov--;
+		}
+		if(niov > 0){
+			iov->iov_base = (char *)iov->iov_base + got;
+			iov->iov_len -= got;
+		}
+	}
+	return 0;
+}
+
+/* Read spans sorted by file offset. Runs of spans whose gaps are at most
+ * RASTER_MERGE_GAP go out as one preadv, the gaps landing in a scratch
+ * buffer; spans further apart take a call each.
+ */
+int raster_readv(RASTER *ras, RSPAN *span, int n)
+{
+	struct iovec iov[RASTER_MAX_IOV];
+	int i = 0;
+
+	if(ras->map != NULL){
+		for(i=0; i<n; i++){
+			if(span[i].off < 0 || span[i].off + (long long)span[i].len > ras->size){
+				return -1;
+			}
+			if(ras->swap){
+				kern_bswap(span[i].dst, ras->map + span[i].off, span[i].len, ras->dsize);
+			}
+			else{
+				memcpy(span[i].dst, ras->map + span[i].off, span[i].len);
+			}
+			ras->io.nused += span[i].len;
+		}
+		return 0;
+	}
+
+	while(i < n){
+		int first = i;
+		long long start = span[i].off;
+		long long end = start + span[i].len;
+		int niov = 0;
+
+		iov[niov].iov_base = span[i].dst;
+		iov[niov].iov_len = span[i].len;
+		niov++;
+		ras->io.nused += span[i].len;
+		i++;
+
+		while(i < n && niov+2 <= RASTER_MAX_IOV && span[i].off >= end && span[i].off-end <= RASTER_MERGE_GAP){
+			if(span[i].off > end){
+				iov[niov].iov_base = ras->gap;
+				iov[niov].iov_len = span[i].off - end;
+				niov++;
+			}
+			iov[niov].iov_base = span[i].dst;
+			iov[niov].iov_len = span[i].len;
+			niov++;
+			end = span[i].off + span[i].len;
+			ras->io.nused += span[i].len;
+			i++;
+		}
+
+		if(0 != preadv_full(ras->fd, iov, niov, start)){
+			return -1;
+		}
+		if(ras->swap){
+			for(; first<i; first++){
+				kern_bswap(span[first].dst, span[first].dst, span[first].len, ras->dsize);
+			}
+		}
+		ras->io.nreq += end - start;
+		ras->io.ncall++;
+	}
+
+	return 0;
+}
+
+/* Prefetch mapped spans sorted by file offset, page aligned, skipping
+ * spans shorter than RASTER_ADVISE_MIN. Unless rows are addressed in the
+ * mapping this is a no-op.
+ */
+void raster_advise(RASTER *ras, RSPAN *span, int n)
+{
+	long long page = sysconf(_SC_PAGESIZE);
+	int i;
+
+	if(!ras->direct){
+		return;
+	}
+	for(i=0; i<n; i++){
+		ras->io.nused += span[i].len;
+		if(span[i].len < RASTER_ADVISE_MIN){
+			continue;
+		}
+		long long a = span[i].off / page * page;
+		long long e = span[i].off + span[i].len;
+		if(e > ras->size){
+			e = ras->size;
+		}
+		if(e > a){
+			madvise(ras->map + a, (size_t)(e - a), MADV_WILLNEED);
+			ras->io.nreq += e - a;
+			ras->io.ncall++;
+		}
+	}
+}
+
+static int cmp_span(const void *a, const void *b)
+{
+	long long x = ((const RSPAN *)a)->off;
+	long long y = ((const RSPAN *)b)->off;
+	return x < y ? -1 : (x > y);
+}
+
+void raster_sort_spans(RSPAN *span, int n)
+{
+	qsort(span, n, sizeof(RSPAN), cmp_span);
+}
+
+// geometry, interleave, value size, byte order and header offset of the image
+int raster_layout(RASTER *ras, ENVI_HDR *envi)
+{
+	const unsigned short one = 1;
+	int host = *(const unsigned char *)&one == 0;
+
+	if(envi->il != ENVI_BSQ && envi->il != ENVI_BIL && envi->il != ENVI_BIP){
+		return -1;
+	}
+	if(envi_dsize(envi->dtype) == 0){
+		return -1;
+	}
+	ras->il = envi->il;
+	ras->nrow = envi->nrow;
+	ras->ncol = envi->ncol;
+	ras->nband = envi->nband;
+	ras->dsize = envi_dsize(envi->dtype);
+	ras->hoffset = envi->hoffset;
+	ras->swap = ras->dsize > 1 && (envi->byteorder != 0) != host;
+	// an odd header offset leaves mapped values misaligned: copy them
+	ras->direct = ras->map != NULL && !ras->swap && ras->hoffset % ras->dsize == 0;
+	return 0;
+}
+
+// file byte offset of value (r, c, b)
+long long raster_offset(RASTER *ras, int r, int c, int b)
+{
+	long long i;
+
+	switch(ras->il){
+	case ENVI_BSQ:
+		i = ((long long)b*ras->nrow + r)*ras->ncol + c;
+		break;
+	case ENVI_BIL:
+		i = ((long long)r*ras->nband + b)*ras->ncol + c;
+		break;
+	default:
+		i = ((long long)r*ras->ncol + c)*ras->nband + b;
+	}
+	return ras->hoffset + i * ras->dsize;
+}
+
+/* Spans holding columns c1..c2 of row r, all bands: one for BIP, one per
+ * band for BIL and BSQ. Each goes to its place in the row buffer row, or
+ * points into the mapping. Returns the number of spans.
+ */
+int raster_row_spans(RASTER *ras, int r, int c1, int c2, char *row, RSPAN *span)
+{
+	long long len = (long long)(c2-c1+1) * ras->dsize;
+	int b;
+
+	if(ras->il == ENVI_BIP){
+		span[0].off = raster_offset(ras, r, c1, 0);
+		span[0].len = len * ras->nband;
+		span[0].dst = ras->direct ? ras->map + span[0].off : row + (long long)c1*ras->nband*ras->dsize;
+		return 1;
+	}
+	for(b=0; b<ras->nband; b++){
+		span[b].off = raster_offset(ras, r, c1, b);
+		span[b].len = len;
+		span[b].dst = ras->direct ? ras->map + span[b].off : row + ((long long)b*ras->ncol + c1)*ras->dsize;
+	}
+	return ras->nband;
+}
+
+/* Band 0 of row r: in the mapping, or the buffered row. bstride is the
+ * distance between bands in values for BIL and BSQ.
+ */
+char *raster_row(RASTER *ras, int r, char *row, long *bstride)
+{
+	*bstride = ras->ncol;
+	if(!ras->direct){
+		return row;
+	}
+	if(ras->il == ENVI_BSQ){
+		*bstride = (long)ras->nrow * ras->ncol;
+	}
+	return ras->map + raster_offset(ras, r, 0, 0);
+}
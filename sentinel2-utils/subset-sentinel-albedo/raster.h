@@ -0,0 +1,62 @@
+#ifndef __INC_RASTER_H
+#define __INC_RASTER_H
+
+#include <stddef.h>
+#include "envi.h"
+
+// gaps up to this many bytes between spans are read and dropped rather
+// than costing another read call
+#define RASTER_MERGE_GAP (16384)
+#define RASTER_MAX_IOV (1024)
+// mapped spans at least this long get a MADV_WILLNEED hint; shorter ones
+// cost a page fault or two, no more than the hint itself
+#define RASTER_ADVISE_MIN (65536)
+
+typedef struct{
+	long long nreq;		// bytes requested from the file, gaps included
+	long long nused;	// bytes of the requested spans
+	long long ncall;	// read (or madvise) calls
+}IO_STAT;
+
+// a contiguous byte span of the file and where it goes in memory
+typedef struct{
+	long long off;
+	size_t len;
+	void *dst;
+}RSPAN;
+
+/* An open image file. With map set the whole file is mapped read-only
+ * and windows address it directly; otherwise spans are read with preadv.
+ * Values in the other byte order are swapped on the way into the row
+ * buffer, so a swapped mapping is copied rather than addressed (direct
+ * unset). Rows are buffered as in a BIP file, or as nband runs of ncol
+ * values for BIL and BSQ files.
+ */
+typedef struct{
+	int fd;
+	char *gap;
+	char *map;
+	long long size;
+	int il;
+	int nrow;
+	int ncol;
+	int nband;
+	int dsize;
+	long long hoffset;
+	int swap;
+	int direct;
+	IO_STAT io;
+}RASTER;
+
+int raster_open(RASTER *ras, char *fname, int use_map);
+void raster_close(RASTER *ras);
+int raster_readv(RASTER *ras, RSPAN *span, int n);
+void raster_advise(RASTER *ras, RSPAN *span, int n);
+void raster_sort_spans(RSPAN *span, int n);
+
+int raster_layout(RASTER *ras, ENVI_HDR *envi);
+long long raster_offset(RASTER *ras, int r, int c, int b);
+int raster_row_spans(RASTER *ras, int r, int c1, int c2, char *row, RSPAN *span);
+char *raster_row(RASTER *ras, int r, char *row, long *bstride);
+
+#endif
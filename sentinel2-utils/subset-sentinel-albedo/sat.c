@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sat.h"
+#include "raster.h"
+
+/* One image row as nband (valid, value) pairs per pixel. ps and bs are
+ * the pixel and band strides of the row in values.
+ */
+#define SAT_FETCH(name, T) \
+static void name(const char *row, long ncol, int nband, long ps, long bs, const NODATA *nd, long long *v) \
+{ \
+	const T *p = (const T *)row; \
+	T ndv = nd->set ? (T)nd->value : 0; \
+	long c; \
+	int b; \
+	for(c=0; c<ncol; c++){ \
+		for(b=0; b<nband; b++){ \
+			T x = p[c*ps + b*bs]; \
+			*v++ = !(nd->set && x == ndv); \
+			*v++ = x; \
+		} \
+	} \
+}
+
+SAT_FETCH(fetch_u8, unsigned char)
+SAT_FETCH(fetch_i16, short)
+SAT_FETCH(fetch_u16, unsigned short)
+
+typedef void (*SAT_FETCH_FN)(const char *row, long ncol, int nband, long ps, long bs, const NODATA *nd, long long *v);
+
+static SAT_FETCH_FN sat_fetch(int dtype)
+{
+	switch(dtype){
+	case 1:
+		return fetch_u8;
+	case 2:
+		return fetch_i16;
+	case 12:
+		return fetch_u16;
+	}
+	return NULL;
+}
+
+int sat_supported(int dtype)
+{
+	return sat_fetch(dtype) != NULL;
+}
+
+static void sat_name(char *fenvi, char *name, size_t n)
+{
+	snprintf(name, n, "%s%s", fenvi, SAT_SUFFIX);
+}
+
+static void sat_header(SAT_HDR *h, ENVI_HDR *envi, const NODATA *nd, struct stat *st)
+{
+	memset(h, 0, sizeof(SAT_HDR));
+	memcpy(h->magic, SAT_MAGIC, sizeof(h->magic));
+	h->nrow = envi->nrow;
+	h->ncol = envi->ncol;
+	h->nband = envi->nband;
+	h->dtype = envi->dtype;
+	h->byteorder = envi->byteorder;
+	h->ndset = nd->set;
+	h->ndvalue = nd->set ? nd->value : 0;
+	h->hoffset = envi->hoffset;
+	h->src_size = st->st_size;
+	h->src_mtime = st->st_mtim.tv_sec;
+	h->src_mtime_ns = st->st_mtim.tv_nsec;
+}
+
+/* Write the sidecar of image fenvi, one image row at a time: each cell
+ * row is the previous one plus the running sums along the image row.
+ * Written under a temporary name and renamed, so readers never see a
+ * partial table.
+ */
+int sat_build(char *fenvi, ENVI_HDR *envi, const NODATA *nd)
+{
+	SAT_FETCH_FN fetch = sat_fetch(envi->dtype);
+	long nrec = (long)(envi->ncol + 1) * envi->nband * 3;
+	long long *prev = NULL, *cur = NULL, *v = NULL;
+	char *row = NULL;
+	RSPAN *span = NULL;
+	FILE *fp = NULL;
+	char name[4096], tmp[4104];
+	struct stat st;
+	SAT_HDR h;
+	RASTER ras;
+	int ret = -1;
+	int r, c, b, nspan;
+	long bstride;
+
+	tmp[0] = '\0';
+	memset(&ras, 0, sizeof(RASTER));
+	ras.fd = -1;
+	if(fetch == NULL){
+		fprintf(stderr, "NO SUMMED-AREA TABLE FOR DATA TYPE %d.\n", envi->dtype);
+		return -1;
+	}
+	if(stat(fenvi, &st) != 0 || 0 != raster_open(&ras, fenvi, 0) || 0 != raster_layout(&ras, envi)){
+		fprintf(stderr, "CAN NOT OPEN %s\n", fenvi);
+		goto done;
+	}
+	if(ras.size < ras.hoffset + (long long)ras.dsize*envi->nrow*envi->ncol*envi->nband){
+		fprintf(stderr, "FILE SHORTER THAN HEADER SAYS. %s\n", fenvi);
+		goto done;
+	}
+
+	prev = (long long *)calloc(nrec, sizeof(long long));
+	cur = (long long *)calloc(nrec, sizeof(long long));
+	v = (long long *)malloc((long)envi->ncol*envi->nband*2*sizeof(long long));
+	row = (char *)malloc((long)envi->ncol*envi->nband*ras.dsize);
+	span = (RSPAN *)malloc(envi->nband*sizeof(RSPAN));
+	if(prev == NULL || cur == NULL || v == NULL || row == NULL || span == NULL){
+		goto done;
+	}
+
+	sat_name(fenvi, name, sizeof(name));
+	snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+	fp = fopen(tmp, "wb");
+	if(fp == NULL){
+		fprintf(stderr, "CAN NOT WRITE %s\n", tmp);
+		goto done;
+	}
+	sat_header(&h, envi, nd, &st);
+	if(1 != fwrite(&h, sizeof(SAT_HDR), 1, fp) || (size_t)nrec != fwrite(prev, sizeof(long long), nrec, fp)){
+		goto done;
+	}
+
+	for(r=0; r<envi->nrow; r++){
+		nspan = raster_row_spans(&ras, r, 0, envi->ncol-1, row, span);
+		if(0 != raster_readv(&ras, span, nspan)){
+			fprintf(stderr, "READ FAILED. row %d\n", r);
+			goto done;
+		}
+		char *p = raster_row(&ras, r, row, &bstride);
+		if(envi->il == ENVI_BIP){
+			fetch(p, envi->ncol, envi->nband, envi->nband, 1, nd, v);
+		}
+		else{
+			fetch(p, envi->ncol, envi->nband, 1, bstride, nd, v);
+		}
+
+		long long *a = cur + envi->nband*3;
+		long long *u = prev + envi->nband*3;
+		const long long *x = v;
+		memset(cur, 0, envi->nband*3*sizeof(long long));
+		for(c=0; c<envi->ncol; c++){
+			for(b=0; b<envi->nband; b++){
+				// running row sums sit in the cell to the left
+				long long n = a[-3*envi->nband] - u[-3*envi->nband];
+				long long s = a[1-3*envi->nband] - u[1-3*envi->nband];
+				long long q = a[2-3*envi->nband] - u[2-3*envi->nband];
+				if(x[0]){
+					n++;
+					s += x[1];
+					q += x[1]*x[1];
+				}
+				a[0] = u[0] + n;
+				a[1] = u[1] + s;
+				a[2] = u[2] + q;
+				a += 3;
+				u += 3;
+				x += 2;
+			}
+		}
+		if((size_t)nrec != fwrite(cur, sizeof(long long), nrec, fp)){
+			goto done;
+		}
+		long long *t = prev;
+		prev = cur;
+		cur = t;
+	}
+
+	if(0 != fclose(fp)){
+		fp = NULL;
+		goto done;
+	}
+	fp = NULL;
+	if(0 != rename(tmp, name)){
+		goto done;
+	}
+	ret = 0;
+
+done:
+	if(fp != NULL){
+		fclose(fp);
+	}
+	if(ret != 0 && tmp[0] != '\0'){
+		unlink(tmp);
+	}
+	raster_close(&ras);
+	free(prev);
+	free(cur);
+	free(v);
+	free(row);
+	free(span);
+	return ret;
+}
+
+/* Map the sidecar of fenvi if it was built from the image as it is now,
+ * with the same layout and nodata. Returns -1 when it is missing or stale,
+ * and the caller reads the pixels instead.
+ */
+int sat_open(SAT *sat, char *fenvi, ENVI_HDR *envi, const NODATA *nd)
+{
+	char name[4096];
+	struct stat st;
+	SAT_HDR h, *p;
+	int fd;
+
+	memset(sat, 0, sizeof(SAT));
+	if(!sat_supported(envi->dtype) || stat(fenvi, &st) != 0){
+		return -1;
+	}
+	sat_name(fenvi, name, sizeof(name));
+	fd = open(name, O_RDONLY);
+	if(fd < 0){
+		return -1;
+	}
+
+	sat_header(&h, envi, nd, &st);
+	sat->size = (long long)sizeof(SAT_HDR) + (long long)(envi->nrow+1)*(envi->ncol+1)*envi->nband*3*sizeof(long long);
+	if(fstat(fd, &st) != 0 || st.st_size != sat->size){
+		close(fd);
+		return -1;
+	}
+	sat->map = (char *)mmap(NULL, (size_t)sat->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(sat->map == (char *)MAP_FAILED){
+		sat->map = NULL;
+		return -1;
+	}
+
+	p = (SAT_HDR *)sat->map;
+	if(0 != memcmp(p, &h, sizeof(SAT_HDR))){
+		sat_close(sat);
+		return -1;
+	}
+	// a window reads four scattered cells per row of runs
+	madvise(sat->map, (size_t)sat->size, MADV_RANDOM);
+	sat->cell = (const long long *)(sat->map + sizeof(SAT_HDR));
+	sat->ncol = envi->ncol;
+	sat->nband = envi->nband;
+	return 0;
+}
+
+void sat_close(SAT *sat)
+{
+	if(sat->map != NULL){
+		munmap(sat->map, (size_t)sat->size);
+	}
+	sat->map = NULL;
+	sat->cell = NULL;
+}
+
+// merge rows r1..r2, columns c1..c2 into the nband moments m
+void sat_rect(const SAT *sat, int r1, int c1, int r2, int c2, MOMENT *m)
+{
+	long w = (long)(sat->ncol + 1) * sat->nband * 3;
+	const long long *a = sat->cell + (long)r1*w + (long)c1*sat->nband*3;
+	const long long *b = sat->cell + (long)r1*w + (long)(c2+1)*sat->nband*3;
+	const long long *c = sat->cell + (long)(r2+1)*w + (long)c1*sat->nband*3;
+	const long long *d = sat->cell + (long)(r2+1)*w + (long)(c2+1)*sat->nband*3;
+	int i;
+
+	for(i=0; i<sat->nband; i++){
+		moment_add_sums(&m[i], d[0]-b[0]-c[0]+a[0], d[1]-b[1]-c[1]+a[1], d[2]-b[2]-c[2]+a[2]);
+		a += 3;
+		b += 3;
+		c += 3;
+		d += 3;
+	}
+}
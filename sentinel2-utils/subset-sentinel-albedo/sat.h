@@ -0,0 +1,49 @@
+#ifndef __INC_SAT_H
+#define __INC_SAT_H
+
+#include "envi.h"
+#include "stats.h"
+#include "kernel.h"
+
+#define SAT_MAGIC "S2SAT001"
+#define SAT_SUFFIX ".sat"
+
+/* Sidecar <image>.sat of summed-area tables: after the header come
+ * (nrow+1)*(ncol+1) cells, row 0 and column 0 zero, each holding for every
+ * band the 64-bit count, sum and sum of squares of the valid values above
+ * and left of it. A rectangle then costs four cells per band, and the
+ * four share one record each, whatever the band count. Only 8- and 16-bit
+ * integer images are indexed, so the sums are exact.
+ * The image size, mtime, layout and nodata it was built from are kept to
+ * tell a stale sidecar.
+ */
+typedef struct{
+	char magic[8];
+	int nrow;
+	int ncol;
+	int nband;
+	int dtype;
+	int byteorder;
+	int ndset;
+	double ndvalue;
+	long long hoffset;
+	long long src_size;
+	long long src_mtime;
+	long long src_mtime_ns;
+}SAT_HDR;
+
+typedef struct{
+	char *map;
+	long long size;
+	const long long *cell;
+	int ncol;
+	int nband;
+}SAT;
+
+int sat_supported(int dtype);
+int sat_build(char *fenvi, ENVI_HDR *envi, const NODATA *nd);
+int sat_open(SAT *sat, char *fenvi, ENVI_HDR *envi, const NODATA *nd);
+void sat_close(SAT *sat);
+void sat_rect(const SAT *sat, int r1, int c1, int r2, int c2, MOMENT *m);
+
+#endif
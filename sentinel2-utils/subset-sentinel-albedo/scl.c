@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "scl.h"
+
+const unsigned char scl_class[256] = {
+	[0] = SCL_NODATA,
+	[1] = SCL_CLEAR,	// saturated or defective, kept as the script does
+	[2] = SCL_CLEAR,
+	[3] = SCL_CLOUD,
+	[4] = SCL_CLEAR,
+	[5] = SCL_CLEAR,
+	[6] = SCL_CLEAR,
+	[7] = SCL_CLOUD,
+	[8] = SCL_CLOUD,
+	[9] = SCL_CLOUD,
+	[10] = SCL_CLOUD,
+	[11] = SCL_SNOW,
+};
+
+// a/f rounded down, for image pixels above or left of the SCL origin
+int scl_div(int a, int f)
+{
+	return a >= 0 ? a / f : -((-a + f - 1) / f);
+}
+
+/* Open SCL image fscl with header hscl over the albedo image img. The SCL
+ * must be one band of bytes in the same projection, its pixel the same
+ * whole multiple of the image pixel on both axes and its corner on the
+ * image pixel grid.
+ */
+int scl_open(SCL *scl, char *fscl, ENVI_HDR *hscl, ENVI_HDR *img)
+{
+	// outer corners of the first pixels, from the tie points
+	double sx = hscl->upleftX - (hscl->tieX - 1) * hscl->pixsizeX;
+	double sy = hscl->upleftY + (hscl->tieY - 1) * hscl->pixsizeY;
+	double ix = img->upleftX - (img->tieX - 1) * img->pixsizeX;
+	double iy = img->upleftY + (img->tieY - 1) * img->pixsizeY;
+	double f, fy, oy, ox;
+
+	memset(scl, 0, sizeof(SCL));
+	scl->ras.fd = -1;
+	if(hscl->dtype != 1 || hscl->nband != 1 || hscl->il < 0){
+		fprintf(stderr, "SCL IS NOT ONE BAND OF BYTES. %s\n", fscl);
+		return -1;
+	}
+	if(!hscl->have_map || strcmp(hscl->proj, img->proj) != 0 || hscl->utmzone != img->utmzone){
+		fprintf(stderr, "SCL NOT IN THE IMAGE PROJECTION. %s\n", fscl);
+		return -1;
+	}
+	f = hscl->pixsizeX / img->pixsizeX;
+	fy = hscl->pixsizeY / img->pixsizeY;
+	oy = (sy - iy) / img->pixsizeY;
+	ox = (ix - sx) / img->pixsizeX;
+	if(floor(f+0.5) < 1 || fabs(f - floor(f+0.5)) > 1e-6 || fabs(fy - f) > 1e-6
+			|| fabs(oy - floor(oy+0.5)) > 1e-3 || fabs(ox - floor(ox+0.5)) > 1e-3){
+		fprintf(stderr, "SCL NOT ALIGNED WITH THE IMAGE GRID. %s\n", fscl);
+		return -1;
+	}
+	scl->f = (int)floor(f+0.5);
+	scl->oy = (int)floor(oy+0.5);
+	scl->ox = (int)floor(ox+0.5);
+	scl->nrow = hscl->nrow;
+	scl->ncol = hscl->ncol;
+
+	if(0 != raster_open(&scl->ras, fscl, 0) || 0 != raster_layout(&scl->ras, hscl)){
+		fprintf(stderr, "CAN NOT OPEN %s\n", fscl);
+		raster_close(&scl->ras);
+		return -1;
+	}
+	if(scl->ras.size < scl->ras.hoffset + (long long)scl->nrow*scl->ncol){
+		fprintf(stderr, "FILE SHORTER THAN HEADER SAYS. %s\n", fscl);
+		raster_close(&scl->ras);
+		return -1;
+	}
+	return 0;
+}
+
+void scl_close(SCL *scl)
+{
+	raster_close(&scl->ras);
+}
+
+/* Classes of SCL rows s1..s2, columns t1..t2 into cls, row by row; the
+ * part outside the SCL image is no data.
+ */
+int scl_read(SCL *scl, int s1, int t1, int s2, int t2, unsigned char *cls)
+{
+	int w = t2 - t1 + 1;
+	int a = t1 > 0 ? t1 : 0;
+	int b = t2 < scl->ncol-1 ? t2 : scl->ncol-1;
+	unsigned char *row = (unsigned char *)malloc(scl->ncol);
+	RSPAN span;
+	long bstride;
+	int s, t;
+
+	if(row == NULL){
+		return -1;
+	}
+	memset(cls, SCL_NODATA, (size_t)(s2-s1+1)*w);
+	for(s=s1; s<=s2; s++){
+		if(s < 0 || s >= scl->nrow || a > b){
+			continue;
+		}
+		raster_row_spans(&scl->ras, s, a, b, (char *)row, &span);
+		if(0 != raster_readv(&scl->ras, &span, 1)){
+			fprintf(stderr, "READ FAILED. SCL row %d\n", s);
+			free(row);
+			return -1;
+		}
+		const unsigned char *p = (const unsigned char *)raster_row(&scl->ras, s, (char *)row, &bstride);
+		unsigned char *q = cls + (long)(s-s1)*w - t1;
+		for(t=a; t<=b; t++){
+			q[t] = scl_class[p[t]];
+		}
+	}
+	free(row);
+	return 0;
+}
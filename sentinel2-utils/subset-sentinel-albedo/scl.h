@@ -0,0 +1,38 @@
+#ifndef __INC_SCL_H
+#define __INC_SCL_H
+
+#include "envi.h"
+#include "raster.h"
+
+/* Pixel classes of the L2A scene classification (SCL) image, as the
+ * parseSCL screening of subset_sentinel2_sr.py: no data, clear and snow
+ * free, cloud contaminated (shadow, unclassified, cloud, cirrus), snow.
+ */
+#define SCL_NODATA (0)
+#define SCL_CLEAR (1)
+#define SCL_CLOUD (2)
+#define SCL_SNOW (3)
+#define SCL_NCLASS (4)
+
+// class of each SCL code; codes past 11 are no data
+extern const unsigned char scl_class[256];
+
+/* An SCL image on the grid of an albedo image. One SCL pixel covers f x f
+ * image pixels; image pixel (r, c) lies in SCL pixel ((r+oy)/f, (c+ox)/f),
+ * rounded down.
+ */
+typedef struct{
+	RASTER ras;
+	int nrow;
+	int ncol;
+	int f;
+	int oy;
+	int ox;
+}SCL;
+
+int scl_open(SCL *scl, char *fscl, ENVI_HDR *hscl, ENVI_HDR *img);
+void scl_close(SCL *scl);
+int scl_div(int a, int f);
+int scl_read(SCL *scl, int s1, int t1, int s2, int t2, unsigned char *cls);
+
+#endif
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "site.h"
+#include "footprint.h"
+
+/* Site list in CSV, one site per line:
+ *   id,lat,lon,window[,shape]
+ * window is the footprint size in meter, the side of a square or with
+ * shape "circle" the diameter of a circle. A header line and lines
+ * starting with '#' are skipped.
+ */
+int read_sites(char *fsite, SITE **sites, int *nsite)
+{
+	FILE *fp = fopen(fsite, "r");
+	if(fp == NULL){
+		fprintf(stderr, "CAN NOT OPEN SITE LIST %s\n", fsite);
+		return -1;
+	}
+
+	char line[1024];
+	char shape[16];
+	int n = 0, cap = 0, nline = 0;
+	SITE *p = NULL;
+	SITE st;
+
+	while(fgets(line, sizeof(line), fp) != NULL){
+		nline++;
+		line[strcspn(line, "\r\n")] = '\0';
+		if(line[0] == '\0' || line[0] == '#'){
+			continue;
+		}
+		shape[0] = '\0';
+		if(4 > sscanf(line, " %63[^,], %lf, %lf, %d , %15s", st.id, &st.lat, &st.lon, &st.window, shape)
+				|| (st.shape = shape[0] == '\0' ? FP_SQUARE : fp_shape(shape)) < 0){
+			if(n == 0 && nline == 1){
+				// header
+				continue;
+			}
+			fprintf(stderr, "BAD SITE LINE %d: %s\n", nline, line);
+			free(p);
+			fclose(fp);
+			return -1;
+		}
+		if(n == cap){
+			cap = cap > 0 ? cap*2 : 64;
+			SITE *q = (SITE *)realloc(p, cap*sizeof(SITE));
+			if(q == NULL){
+				free(p);
+				fclose(fp);
+				return -1;
+			}
+			p = q;
+		}
+		p[n++] = st;
+	}
+
+	fclose(fp);
+	*sites = p;
+	*nsite = n;
+	return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef __INC_SITE_H
+#define __INC_SITE_H
+
+typedef struct{
+	char id[64];
+	double lat;
+	double lon;
+	int window;		// footprint size in meter, side or diameter
+	int shape;		// FP_SQUARE or FP_CIRCLE
+}SITE;
+
+int read_sites(char *fsite, SITE **sites, int *nsite);
+
+#endif
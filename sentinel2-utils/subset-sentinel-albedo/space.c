@@ -1,17 +1,33 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <pthread.h>
 #include "proj.h"
 #include "cproj.h"
+#include "space.h"
+#include "tmerc.h"
+#include "kernel.h"
+
+// points per pass of the batch transforms, kept in cache
+#define SPACE_CHUNK (256)
+
+// transform of a SPACE_PROJ
+#define SPACE_GCTP (0)
+#define SPACE_TMERC (1)		// WGS-84 UTM, native
+#define SPACE_GEO (2)		// geographic, map units are degrees
+
+// bound on the native UTM transform's departure from GCTP, metres
+#define SPACE_CHECK_TOL (1e-3)
+
+// sphere of the MODIS and VIIRS sinusoidal grid
+#define MODIS_RADIUS (6371007.181)
 
 #define MAX_PROJ (31)  /* Maximum map projection number */
 
 double DE2RA = 0.01745329252;
 double RA2DE = 57.2957795129;
 
-long (*my_for_trans)() = NULL;
-long (*my_inv_trans)() = NULL;
-
 void for_init(long proj_num, long zone, double *proj_param, long sphere,
               char *file27, char *file83, long *iflag, 
 	      long (*for_trans[MAX_PROJ + 1])());
@@ -19,93 +35,454 @@ void inv_init(long proj_num, long zone, double *proj_param, long sphere,
               char *file27, char *file83, long *iflag, 
 	      long (*inv_trans[MAX_PROJ + 1])());
 
-double ul_corner_x;
-double ul_corner_y;
-double pixel_size;
+/* A projection, zone and datum as GCTP is initialised for it. GCTP keeps
+ * the parameters of its last for_init/inv_init of each projection in its
+ * own statics, so the transforms of an entry are valid only while it is
+ * the active entry: every call into GCTP holds gctp_lock and makes its
+ * entry active first, initialising GCTP again only when the entry
+ * changes. WGS-84 UTM has its own transform instead, native, which
+ * holds all its state in the entry and needs neither, and so do
+ * geographic grids, which GCTP has no transform for.
+ */
+struct SPACE_PROJ{
+	long proj_num;
+	long zone;
+	long sphere;
+	double param[15];
+	long (*for_trans)();
+	long (*inv_trans)();
+	int kind;
+	TMERC tm;
+	struct SPACE_PROJ *next;
+};
 
-int SetupSpace(long proj_num, long zone, double *proj_param, long sphere, double ul_x, double ul_y, double pix_size)
+static pthread_mutex_t gctp_lock = PTHREAD_MUTEX_INITIALIZER;
+static SPACE_PROJ *cache = NULL;
+static const SPACE_PROJ *active = NULL;
+static int use_gctp = 0;
+
+void space_use_gctp(int on)
+{
+	use_gctp = on;
+}
+
+// WGS-84 UTM with the standard parameters, which the native transform covers
+static int space_native(long proj_num, long zone, double *proj_param, long sphere)
+{
+	int i;
+
+	if(use_gctp || proj_num != UTM || sphere != 12 || zone == 0 || zone < -60 || zone > 60){
+		return 0;
+	}
+	for(i=0; i<15; i++){
+		if(proj_param[i] != 0){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// initialise GCTP for entry p, under gctp_lock
+static int gctp_activate(SPACE_PROJ *p)
 {
   char file27[1024];          /* name of NAD 1927 parameter file */
   char file83[1024];          /* name of NAD 1983 parameter file */
-  //char libgctp[1024];       /* storage for mrttables */
 	char *libgctp;
-  
 	long (*for_trans[MAX_PROJ + 1])();
-  long (*inv_trans[MAX_PROJ + 1])();
-  
-	/*
-  char *ptr = getenv("LIBGCTP");
-	if(ptr == NULL){
-		printf("error.\n");
-		return -1;
-	}
-	*/
+	long (*inv_trans[MAX_PROJ + 1])();
+	long iflag = 0;
 
-  //strcpy(libgctp, "/program/MRTSwath/MRTSwath/data");
 	libgctp = (char *)getenv("LIBGCTP");
-  sprintf(file27, "%s/nad27sp", libgctp);
-  sprintf(file83, "%s/nad83sp", libgctp);
+	snprintf(file27, sizeof(file27), "%s/nad27sp", libgctp);
+	snprintf(file83, sizeof(file83), "%s/nad83sp", libgctp);
 
-	long iflag = 0;
-
-	for_init(proj_num, zone, proj_param, sphere, file27, file83, &iflag, for_trans);
+	active = NULL;
+	for_init(p->proj_num, p->zone, p->param, p->sphere, file27, file83, &iflag, for_trans);
 	if(iflag != 0){
 		printf("for_init iflag=%ld\n", iflag);
 		return -1;
 	}
-  my_for_trans = for_trans[proj_num];
-	
-	inv_init(proj_num, zone, proj_param, sphere, file27, file83, &iflag, inv_trans);
+	inv_init(p->proj_num, p->zone, p->param, p->sphere, file27, file83, &iflag, inv_trans);
 	if(iflag != 0){
-		printf("inv_init iflag=%d\n", iflag);
+		printf("inv_init iflag=%ld\n", iflag);
 		return -1;
 	}
-  my_inv_trans = inv_trans[proj_num];
+	p->for_trans = for_trans[p->proj_num];
+	p->inv_trans = inv_trans[p->proj_num];
+	active = p;
+	return 0;
+}
 
-	pixel_size = pix_size;
-	ul_corner_x = ul_x;
-	ul_corner_y = ul_y;
+// cache entry of a projection, zone and datum, created on first use
+static SPACE_PROJ *space_proj(long proj_num, long zone, double *proj_param, long sphere)
+{
+	SPACE_PROJ *p;
 
-	return 0;
+	pthread_mutex_lock(&gctp_lock);
+	for(p=cache; p!=NULL; p=p->next){
+		if(p->proj_num == proj_num && p->zone == zone && p->sphere == sphere
+				&& memcmp(p->param, proj_param, sizeof(p->param)) == 0){
+			pthread_mutex_unlock(&gctp_lock);
+			return p;
+		}
+	}
+	p = (SPACE_PROJ *)calloc(1, sizeof(SPACE_PROJ));
+	if(p != NULL){
+		p->proj_num = proj_num;
+		p->zone = zone;
+		p->sphere = sphere;
+		memcpy(p->param, proj_param, sizeof(p->param));
+		p->kind = proj_num == GEO ? SPACE_GEO : space_native(proj_num, zone, proj_param, sphere) ? SPACE_TMERC : SPACE_GCTP;
+		if(p->kind == SPACE_TMERC){
+			tm_utm(&p->tm, zone);
+		}
+		if(proj_num < 0 || proj_num > MAX_PROJ || (p->kind == SPACE_GCTP && 0 != gctp_activate(p))){
+			free(p);
+			p = NULL;
+		}
+		else{
+			p->next = cache;
+			cache = p;
+		}
+	}
+	pthread_mutex_unlock(&gctp_lock);
+	return p;
+}
+
+int space_setup(SPACE *sp, long proj_num, long zone, double *proj_param, long sphere, double ul_x, double ul_y, double pix_size)
+{
+	sp->proj = space_proj(proj_num, zone, proj_param, sphere);
+	sp->ul_x = ul_x;
+	sp->ul_y = ul_y;
+	sp->pix_size = pix_size;
+	sp->pix_y = pix_size;
+	return sp->proj != NULL ? 0 : -1;
 }
 
-int ToSpace(double lat, double lon, double *l, double *s)
+// degrees as the packed DDDMMMSSS.SS angles of the GCTP parameters
+static double space_dms(double deg)
 {
-	double x, y;
+	double a = fabs(deg);
+	double d = floor(a);
+	double m = floor((a - d) * 60);
+	double sec = ((a - d) * 60 - m) * 60;
 
-	lat *= DE2RA;
-	lon *= DE2RA;
+	return copysign(d * 1000000 + m * 1000 + sec, deg);
+}
 
-  if(my_for_trans == NULL){
+// ENVI projection type of a map info projection name, when there is no projection info
+static int space_type(const char *name)
+{
+	if(strcmp(name, "UTM") == 0){
+		return ENVI_PROJ_UTM;
+	}
+	if(strcmp(name, "Geographic Lat/Lon") == 0){
+		return ENVI_PROJ_GEO;
+	}
+	if(strcmp(name, "Sinusoidal") == 0){
+		return ENVI_PROJ_SNSOID;
+	}
+	if(strcmp(name, "Polar Stereographic") == 0){
+		return ENVI_PROJ_PS;
+	}
+	if(strcmp(name, "Albers Conical Equal Area") == 0){
+		return ENVI_PROJ_ALBERS;
+	}
+	return -1;
+}
+
+/* Context of the grid in the map info of an image header, the projection
+ * by the type of its projection info or else by the map info name: UTM
+ * in the zone and hemisphere given, Geographic Lat/Lon, Sinusoidal,
+ * Polar Stereographic and Albers Conical Equal Area. The projection info
+ * parameters are ENVI's, the ellipsoid axes first:
+ *   Sinusoidal   radius, lon0, false easting, false northing
+ *                (or a, b, lon0, false easting, false northing)
+ *   Polar St.    a, b, latitude of true scale, lon0, false easting, northing
+ *   Albers       a, b, lat0, lon0, false easting, northing, parallel 1, 2
+ * A Sinusoidal grid without projection info is the MODIS sphere; the
+ * others need it. The tie point may be any pixel of the grid.
+ */
+int space_init(SPACE *sp, const ENVI_HDR *envi)
+{
+	double param[15] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
+	const double *pp = envi->proj_param;
+	int np = envi->have_proj ? envi->nproj_param : 0;
+	int type = envi->have_proj ? envi->proj_type : space_type(envi->proj);
+	long proj_num;
+	long sphere = strcmp(envi->datum, "WGS-84") == 0 ? 12 : -1;
+	long zone = 0;
+	int ret;
+
+	if(envi->rotation != 0){
+		fprintf(stderr, "ROTATED MAP GRID NOT SUPPORTED.\n");
 		return -1;
 	}
-  if (my_for_trans(lon, lat, &x, &y) != 0) {
+	if(type == ENVI_PROJ_UTM){
+		proj_num = UTM;
+		zone = strcmp(envi->orig, "South") == 0 ? -envi->utmzone : envi->utmzone;
+	}
+	else if(type == ENVI_PROJ_GEO){
+		proj_num = GEO;
+	}
+	else if(type == ENVI_PROJ_SNSOID){
+		proj_num = SNSOID;
+		sphere = -1;
+		if(np >= 5){
+			param[0] = pp[0];
+			param[1] = pp[1];
+			pp++;
+		}
+		else{
+			param[0] = np > 0 ? pp[0] : MODIS_RADIUS;
+		}
+		if(np >= 4){
+			param[4] = space_dms(pp[1]);
+			param[6] = pp[2];
+			param[7] = pp[3];
+		}
+	}
+	else if(type == ENVI_PROJ_PS && np >= 6){
+		proj_num = PS;
+		sphere = -1;
+		param[0] = pp[0];
+		param[1] = pp[1];
+		param[4] = space_dms(pp[3]);
+		param[5] = space_dms(pp[2]);
+		param[6] = pp[4];
+		param[7] = pp[5];
+	}
+	else if(type == ENVI_PROJ_ALBERS && np >= 8){
+		proj_num = ALBERS;
+		sphere = -1;
+		param[0] = pp[0];
+		param[1] = pp[1];
+		param[2] = space_dms(pp[6]);
+		param[3] = space_dms(pp[7]);
+		param[4] = space_dms(pp[3]);
+		param[5] = space_dms(pp[2]);
+		param[6] = pp[4];
+		param[7] = pp[5];
+	}
+	else{
+		fprintf(stderr, "UNSUPPORTED PROJECTION %s%s.\n", envi->proj, type == ENVI_PROJ_PS || type == ENVI_PROJ_ALBERS ? " WITHOUT PROJECTION INFO" : "");
 		return -1;
 	}
+	ret = space_setup(sp, proj_num, zone, param, sphere,
+			envi->upleftX - (envi->tieX - 1) * envi->pixsizeX, envi->upleftY + (envi->tieY - 1) * envi->pixsizeY, envi->pixsizeX);
+	sp->pix_y = envi->pixsizeY;
+	return ret;
+}
+
+/* Ground spacing in metres of the lines, my, and of the samples, mx, at
+ * latitude lat, to size footprints given in metres: the pixel size of a
+ * projected grid, and for a geographic grid the WGS-84 extents of the
+ * pixel along the meridian and the parallel.
+ */
+void space_pixel_m(const SPACE *sp, double lat, double *my, double *mx)
+{
+	double a = 6378137.0, e2 = 0.00669437999014;
+	double sl, w;
+
+	if(sp->proj == NULL || sp->proj->kind != SPACE_GEO){
+		*my = sp->pix_y;
+		*mx = sp->pix_size;
+		return;
+	}
+	sl = sin(lat * DE2RA);
+	w = 1 - e2 * sl * sl;
+	*my = DE2RA * sp->pix_y * a * (1 - e2) / (w * sqrt(w));
+	*mx = DE2RA * sp->pix_size * a * cos(lat * DE2RA) / sqrt(w);
+}
 
-	*l = (ul_corner_y - y) / pixel_size;
-  *s = (x - ul_corner_x) / pixel_size;
+int space_to(const SPACE *sp, double lat, double lon, double *l, double *s)
+{
+	return space_to_n(sp, &lat, &lon, l, s, 1);
+}
 
-  return 0;
+int space_from(const SPACE *sp, double l, double s, double *lat, double *lon)
+{
+	return space_from_n(sp, &l, &s, lat, lon, 1);
 }
 
-int FromSpace(double l, double s, double *lat, double *lon)
+int space_to_n(const SPACE *sp, const double *lat, const double *lon, double *l, double *s, long n)
 {
+	SPACE_PROJ *p = sp->proj;
+	double x[SPACE_CHUNK], y[SPACE_CHUNK];
+	long i, j, m;
+	int ret = 0;
+
+	if(p == NULL){
+		return -1;
+	}
+	if(p->kind == SPACE_GEO){
+		for(i=0; i<n; i++){
+			l[i] = (sp->ul_y - lat[i]) / sp->pix_y;
+			s[i] = (lon[i] - sp->ul_x) / sp->pix_size;
+		}
+		return 0;
+	}
+	if(p->kind == SPACE_TMERC){
+		for(i=0; i<n; i+=m){
+			m = n - i < SPACE_CHUNK ? n - i : SPACE_CHUNK;
+			tm_forward(&p->tm, lat + i, lon + i, x, y, m);
+			for(j=0; j<m; j++){
+				l[i+j] = (sp->ul_y - y[j]) / sp->pix_y;
+				s[i+j] = (x[j] - sp->ul_x) / sp->pix_size;
+			}
+		}
+		return 0;
+	}
 
-	double x, y;
+	pthread_mutex_lock(&gctp_lock);
+	if(active != p && 0 != gctp_activate(p)){
+		pthread_mutex_unlock(&gctp_lock);
+		return -1;
+	}
+	for(i=0; i<n; i++){
+		if(p->for_trans(lon[i] * DE2RA, lat[i] * DE2RA, &x[0], &y[0]) != 0){
+			l[i] = s[i] = NAN;
+			ret = -1;
+			continue;
+		}
+		l[i] = (sp->ul_y - y[0]) / sp->pix_y;
+		s[i] = (x[0] - sp->ul_x) / sp->pix_size;
+	}
+	pthread_mutex_unlock(&gctp_lock);
+	return ret;
+}
 
-  y = ul_corner_y - (l * pixel_size);
-  x = ul_corner_x + (s * pixel_size);
+int space_from_n(const SPACE *sp, const double *l, const double *s, double *lat, double *lon, long n)
+{
+	SPACE_PROJ *p = sp->proj;
+	double x[SPACE_CHUNK], y[SPACE_CHUNK];
+	long i, j, m;
+	int ret = 0;
 
-  if(my_inv_trans == NULL){
+	if(p == NULL){
 		return -1;
 	}
- 
-	if(my_inv_trans(x, y, lon, lat) != 0) 
+	if(p->kind == SPACE_GEO){
+		for(i=0; i<n; i++){
+			lat[i] = sp->ul_y - (l[i] * sp->pix_y);
+			lon[i] = sp->ul_x + (s[i] * sp->pix_size);
+		}
+		return 0;
+	}
+	if(p->kind == SPACE_TMERC){
+		for(i=0; i<n; i+=m){
+			m = n - i < SPACE_CHUNK ? n - i : SPACE_CHUNK;
+			for(j=0; j<m; j++){
+				y[j] = sp->ul_y - (l[i+j] * sp->pix_y);
+				x[j] = sp->ul_x + (s[i+j] * sp->pix_size);
+			}
+			tm_inverse(&p->tm, x, y, lat + i, lon + i, m);
+		}
+		return 0;
+	}
+
+	pthread_mutex_lock(&gctp_lock);
+	if(active != p && 0 != gctp_activate(p)){
+		pthread_mutex_unlock(&gctp_lock);
 		return -1;
+	}
+	for(i=0; i<n; i++){
+		y[0] = sp->ul_y - (l[i] * sp->pix_y);
+		x[0] = sp->ul_x + (s[i] * sp->pix_size);
+		if(p->inv_trans(x[0], y[0], &lon[i], &lat[i]) != 0){
+			lat[i] = lon[i] = NAN;
+			ret = -1;
+			continue;
+		}
+		lat[i] *= RA2DE;
+		lon[i] *= RA2DE;
+	}
+	pthread_mutex_unlock(&gctp_lock);
+	return ret;
+}
+
+/* Compare the native UTM transform with GCTP, both ways, on a grid of
+ * points over the whole latitude range of UTM and out to both zone
+ * edges, in zones of both hemispheres, on each instruction set the CPU
+ * supports. Forward the map coordinates are compared, inverse the ground
+ * distance between the latitudes and longitudes of GCTP's map
+ * coordinates. Most of what remains is GCTP's: its meridian distance is
+ * a series to e^6, short by up to a millimetre near 70 degrees, and its
+ * inverse series loses accuracy past the edges. Returns the points off
+ * by more than SPACE_CHECK_TOL.
+ */
+int space_check(void)
+{
+	static const long zone[] = {1, 13, 31, 60, -1, -33, -60};
+	static char *isa[] = {"scalar", "avx2", "avx512"};
+	char saved[32];
+	SPACE_PROJ gp, np;
+	SPACE sg, sn;
+	double lat[SPACE_CHUNK], lon[SPACE_CHUNK];
+	double lg[SPACE_CHUNK], sgc[SPACE_CHUNK], ln[SPACE_CHUNK], snc[SPACE_CHUNK];
+	double pg[SPACE_CHUNK], qg[SPACE_CHUNK], pn[SPACE_CHUNK], qn[SPACE_CHUNK];
+	double d, fmax = 0, imax = 0;
+	long npt = 0;
+	int i, j, k, m, z, bad = 0;
 
-	*lat *= RA2DE;
-	*lon *= RA2DE;
+	snprintf(saved, sizeof(saved), "%s", kernel_name());
+	for(k=0; k<(int)(sizeof(isa)/sizeof(isa[0])); k++){
+		if(0 != kernel_init(isa[k])){
+			continue;
+		}
+		for(z=0; z<(int)(sizeof(zone)/sizeof(zone[0])); z++){
+			memset(&gp, 0, sizeof(SPACE_PROJ));
+			gp.proj_num = UTM;
+			gp.zone = zone[z];
+			gp.sphere = 12;
+			gp.kind = SPACE_GCTP;
+			np = gp;
+			np.kind = SPACE_TMERC;
+			tm_utm(&np.tm, zone[z]);
+			// map coordinates in metres, y up
+			sg.proj = &gp;
+			sn.proj = &np;
+			sg.ul_x = sn.ul_x = sg.ul_y = sn.ul_y = 0;
+			sg.pix_size = sn.pix_size = 1;
+			sg.pix_y = sn.pix_y = -1;
+			pthread_mutex_lock(&gctp_lock);
+			i = gctp_activate(&gp);
+			pthread_mutex_unlock(&gctp_lock);
+			if(i != 0){
+				return -1;
+			}
 
-  return 0;
+			// 0.25 degree steps of latitude, 0.125 of longitude edge to edge
+			for(i=0; i<=(zone[z] > 0 ? 84 : 80)*4; i++){
+				m = 0;
+				for(j=-24; j<=24; j++){
+					lat[m] = zone[z] > 0 ? i * 0.25 : -i * 0.25;
+					lon[m] = np.tm.lon0 + j * 0.125;
+					m++;
+				}
+				if(0 != space_to_n(&sg, lat, lon, lg, sgc, m)){
+					continue;
+				}
+				space_to_n(&sn, lat, lon, ln, snc, m);
+				space_from_n(&sg, lg, sgc, pg, qg, m);
+				space_from_n(&sn, lg, sgc, pn, qn, m);
+				for(j=0; j<m; j++){
+					d = hypot(ln[j] - lg[j], snc[j] - sgc[j]);
+					fmax = d > fmax ? d : fmax;
+					bad += !(d <= SPACE_CHECK_TOL);
+					d = 6378137.0 * DE2RA * hypot(pn[j] - pg[j], (qn[j] - qg[j]) * cos(pg[j] * DE2RA));
+					imax = d > imax ? d : imax;
+					bad += !(d <= SPACE_CHECK_TOL);
+				}
+				npt += m;
+			}
+		}
+		printf("Native UTM on %s checked against GCTP = %ld points, max error forward %.3g m, inverse %.3g m\n", isa[k], npt, fmax, imax);
+		npt = 0;
+		fmax = imax = 0;
+	}
+	// GCTP is initialised for the check entries, which are gone
+	active = NULL;
+	kernel_init(saved);
+	return bad;
 }
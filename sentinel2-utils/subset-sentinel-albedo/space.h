@@ -1,8 +1,43 @@
 #ifndef __INC_SPACE_H
 #define __INC_SPACE_H
 
-int SetupSpace(long proj_num, long zone, double *proj_param, long sphere, double ul_x, double ul_y, double pix_size);
-int ToSpace(double lat, double lon, double *l, double *s);
-int FromSpace(double l, double s, double *lat, double *lon);
+#include "envi.h"
+
+// transform of one projection, zone and datum, shared through the cache
+typedef struct SPACE_PROJ SPACE_PROJ;
+
+/* Projection context of one image grid: its transform and upper left
+ * corner and pixel size in map units, metres or for a geographic grid
+ * degrees. Contexts hold no other state and may be used from any number
+ * of threads.
+ */
+typedef struct{
+	SPACE_PROJ *proj;
+	double ul_x;
+	double ul_y;
+	double pix_size;
+	double pix_y;		// line spacing, pix_size unless the header differs
+}SPACE;
+
+int space_setup(SPACE *sp, long proj_num, long zone, double *proj_param, long sphere, double ul_x, double ul_y, double pix_size);
+int space_init(SPACE *sp, const ENVI_HDR *envi);
+int space_to(const SPACE *sp, double lat, double lon, double *l, double *s);
+int space_from(const SPACE *sp, double l, double s, double *lat, double *lon);
+void space_pixel_m(const SPACE *sp, double lat, double *my, double *mx);
+
+/* Batch forms over arrays of n points, line and sample to and from
+ * latitude and longitude in degrees. Points that fail are NaN and the
+ * call returns -1.
+ */
+int space_to_n(const SPACE *sp, const double *lat, const double *lon, double *l, double *s, long n);
+int space_from_n(const SPACE *sp, const double *l, const double *s, double *lat, double *lon, long n);
+
+// transform WGS-84 UTM through GCTP too, as the reference; before any setup
+void space_use_gctp(int on);
+
+/* Compare the native UTM transform with GCTP both ways over several
+ * zones out to their edges; returns the points off by over a millimetre.
+ */
+int space_check(void);
 
 #endif
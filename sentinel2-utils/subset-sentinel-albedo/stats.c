@@ -0,0 +1,139 @@
+#include <math.h>
+#include <limits.h>
+#include "stats.h"
+
+void moment_init(MOMENT *m)
+{
+	m->n = 0;
+	m->mean = 0.0;
+	m->m2 = 0.0;
+}
+
+// Welford update with one value
+void moment_add(MOMENT *m, double x)
+{
+	double d = x - m->mean;
+	m->n++;
+	m->mean += d / m->n;
+	m->m2 += d * (x - m->mean);
+}
+
+// a*b as the high and low 64-bit words of the 128-bit product
+static void mul_u128(unsigned long long a, unsigned long long b, unsigned long long *hi, unsigned long long *lo)
+{
+	unsigned long long a0 = a & 0xffffffffULL, a1 = a >> 32;
+	unsigned long long b0 = b & 0xffffffffULL, b1 = b >> 32;
+	unsigned long long p00 = a0*b0, p01 = a0*b1, p10 = a1*b0;
+	unsigned long long mid = (p00 >> 32) + (p01 & 0xffffffffULL) + (p10 & 0xffffffffULL);
+
+	*lo = (mid << 32) | (p00 & 0xffffffffULL);
+	*hi = a1*b1 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+}
+
+/* Merge a block given as integer count, sum and sum of squares, e.g. the
+ * valid pixels of one row or a summed-area rectangle. The block M2 is
+ * (n*sumsq - sum*sum)/n with the difference exact: in 64-bit integers
+ * while n*sumsq fits, which covers rows of 8- and 16-bit data, in 128
+ * bits for larger blocks, so no cancellation is left for the division.
+ */
+void moment_add_sums(MOMENT *m, long long n, long long sum, long long sumsq)
+{
+	unsigned long long h1, l1, h2, l2, us;
+	MOMENT b;
+
+	if(n <= 0){
+		return;
+	}
+	b.n = n;
+	b.mean = (double)sum / n;
+	if(sumsq <= LLONG_MAX / n){
+		b.m2 = (double)(n*sumsq - sum*sum) / n;
+	}
+	else{
+		// n*sumsq >= sum*sum, so the difference is not negative
+		us = sum < 0 ? 0ULL - (unsigned long long)sum : (unsigned long long)sum;
+		mul_u128((unsigned long long)n, (unsigned long long)sumsq, &h1, &l1);
+		mul_u128(us, us, &h2, &l2);
+		h1 -= h2 + (l1 < l2);
+		l1 -= l2;
+		b.m2 = ((double)h1 * 18446744073709551616.0 + (double)l1) / n;
+	}
+	moment_merge(m, &b);
+}
+
+void moment_merge(MOMENT *a, const MOMENT *b)
+{
+	long long n;
+	double d;
+
+	if(b->n == 0){
+		return;
+	}
+	if(a->n == 0){
+		*a = *b;
+		return;
+	}
+	n = a->n + b->n;
+	d = b->mean - a->mean;
+	a->mean += d * b->n / n;
+	a->m2 += b->m2 + d * d * ((double)a->n * b->n / n);
+	a->n = n;
+}
+
+// moments of gain*x + offset, so raw values are converted once per window
+void moment_scale(MOMENT *m, double gain, double offset)
+{
+	m->mean = gain * m->mean + offset;
+	m->m2 *= gain * gain;
+}
+
+// population variance, as the window statistics have always reported
+double moment_var(const MOMENT *m)
+{
+	return m->n > 0 ? m->m2 / m->n : 0.0;
+}
+
+double moment_sd(const MOMENT *m)
+{
+	return sqrt(moment_var(m));
+}
+
+void wmoment_init(WMOMENT *m)
+{
+	m->w = 0.0;
+	m->mean = 0.0;
+	m->m2 = 0.0;
+	m->n = 0;
+}
+
+void wmoment_merge(WMOMENT *a, const WMOMENT *b)
+{
+	double w, d;
+
+	if(b->w <= 0.0){
+		return;
+	}
+	if(a->w <= 0.0){
+		*a = *b;
+		return;
+	}
+	w = a->w + b->w;
+	d = b->mean - a->mean;
+	a->mean += d * b->w / w;
+	a->m2 += b->m2 + d * d * (a->w * b->w / w);
+	a->w = w;
+	a->n += b->n;
+}
+
+/* As a MOMENT of the same mean and variance (M2 over the weight) and the
+ * count of weighted values, to be reported as the unweighted ones.
+ */
+MOMENT wmoment_moment(const WMOMENT *m)
+{
+	MOMENT r;
+
+	r.n = m->n;
+	r.mean = m->mean;
+	r.m2 = m->w > 0.0 ? m->m2 * m->n / m->w : 0.0;
+	return r;
+}
@@ -0,0 +1,38 @@
+#ifndef __INC_STATS_H
+#define __INC_STATS_H
+
+/* Count, mean and sum of squared deviations (M2) of a sample. Two
+ * moments of disjoint samples merge exactly (Chan et al.), so partial
+ * results of rows, row blocks, threads or tiles can be combined in any
+ * order.
+ */
+typedef struct{
+	long long n;
+	double mean;
+	double m2;
+}MOMENT;
+
+/* Weighted moments, for pixels counted by their area inside a footprint:
+ * total weight, weighted mean and weighted M2, and the number of values
+ * with a weight.
+ */
+typedef struct{
+	double w;
+	double mean;
+	double m2;
+	long long n;
+}WMOMENT;
+
+void moment_init(MOMENT *m);
+void moment_add(MOMENT *m, double x);
+void moment_add_sums(MOMENT *m, long long n, long long sum, long long sumsq);
+void moment_merge(MOMENT *a, const MOMENT *b);
+void moment_scale(MOMENT *m, double gain, double offset);
+double moment_var(const MOMENT *m);
+double moment_sd(const MOMENT *m);
+
+void wmoment_init(WMOMENT *m);
+void wmoment_merge(WMOMENT *a, const WMOMENT *b);
+MOMENT wmoment_moment(const WMOMENT *m);
+
+#endif
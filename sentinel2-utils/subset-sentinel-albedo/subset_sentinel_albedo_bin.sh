@@ -106,48 +106,11 @@ echo "Albedo file name pattern = ${pattern}"
 # dir=/neponset/nbdata07/albedo/Tower_albedo_Sentinel/NiwotRidge_albedo
 # out=./output/TableMtn2_snowlib4_${lat}_${lon}_30.txt
 
-lnds=($(find $dir/ -name "${pattern}"))
-
-echo "Number of files found = ${#lnds[@]}"
-
-echo "Path_Row,Year,DOY,Lat,Lon,Sensor,Scene_ID,BSA_mean,BSA_sd,BSA_count,WSA_mean,WSA_sd,WSA_count" > ${out}
-
-for envi in ${lnds[@]}; do
-    base=$(basename ${envi})
-    echo $base
-
-    # Get acquisition date from the SAFE folder name. Sentinel-2
-    # granule file name does NOT have acquisition date but only
-    # product creation date.
-    #
-    # Now get acquisition date temporarily from the SAFE folder
-    # name where the granule resides
-    tmp=$(echo ${envi} | grep -o 'S2A_USER_PRD_MSIL2A_.*\.SAFE')
-    if [[ -z ${tmp} ]]; then
-        # not matched, it's new tile-based SAFE format
-        safesub=$(echo ${envi} | grep -o 'MSIL2A_.*')
-        acqstr=${safesub:7:8}
-    else
-        # matched, old scene-based SAFE format
-        safesub=$(echo ${tmp} | grep -o 'V.*\.SAFE')
-        acqstr=${safesub:1:8}
-    fi
-    year=${acqstr:0:4}
-    doy=$(date -d ${acqstr} "+%j")
-
-    # No path or row for Sentinel-2 data
-    path="000"
-    row="000"
-    sensor="MSI"
-    tile="PATH${path}_ROW${row}"
-    echo ${year} ${doy} ${sensor} ${tile}
-
-    echo $exe $envi $lat $lon $window $year $doy $tile $sensor $base
-    tmpout=$($exe $envi $lat $lon $window $year $doy $tile $sensor $base)
-    if [ $? -ne 0 ]; then
-        echo "ERROR, subsetting ${base}"
-        continue
-    else
-        echo ${tmpout} >> ${out}
-    fi
-done
+# sub walks the directory, parses the acquisition date from the SAFE
+# folder name of each granule and writes the whole stats table in one
+# process.
+$exe --lat=${lat} --lon=${lon} --window=${window} --directory=${dir} --pattern="${pattern}" --output=${out}
+if [ $? -ne 0 ]; then
+    echo "ERROR, subsetting files in ${dir}"
+    exit 1
+fi
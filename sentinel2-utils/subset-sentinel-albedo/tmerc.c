@@ -0,0 +1,367 @@
+#include <string.h>
+#include <math.h>
+#include "tmerc.h"
+#include "kernel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TM_X86
+#endif
+
+/* The batch transforms run one loop over the points with no branch and no
+ * libm call in it, so the compiler vectorizes it whole: the elementary
+ * functions below are range reduction and a polynomial, selects instead
+ * of tests, and bit operations for the exponent. They are accurate to a
+ * few units in the last place over the ranges used here, far below the
+ * millimetre. Each loop is built again per instruction set as the
+ * statistics kernels are, and picked with them. The Makefile builds this
+ * file without errno and trapping math, which the loops do not rely on
+ * (square roots are of non-negative values, both sides of each select
+ * finite) and which would otherwise keep branches in them, and without
+ * -ffloat-store, which changes no SSE result but spills every temporary.
+ */
+#define TM_PI (3.14159265358979323846)
+#define TM_LN2_HI (6.93147180369123816490e-01)
+#define TM_LN2_LO (1.90821492927058770002e-10)
+#define TM_PIO2_1 (1.57079632673412561417e+00)
+#define TM_PIO2_2 (6.07710050650619224932e-11)
+#define TM_PIO2_3 (2.02226624879595063154e-21)
+// 1.5 * 2^52: adding it rounds a double to an integer held in the low bits
+#define TM_ROUND (6755399441055744.0)
+#define TM_NEWTON (2)
+
+typedef union{
+	double d;
+	unsigned long long i;
+}TM_BITS;
+
+static inline __attribute__((always_inline)) unsigned long long tm_bits(double x)
+{
+	TM_BITS b;
+	b.d = x;
+	return b.i;
+}
+
+static inline __attribute__((always_inline)) double tm_double(unsigned long long i)
+{
+	TM_BITS b;
+	b.i = i;
+	return b.d;
+}
+
+// e^x for |x| < 708: x = k ln2 + r, |r| <= ln2/2, Taylor to r^13, times 2^k
+static inline __attribute__((always_inline)) double tm_exp(double x)
+{
+	double k = (x * 1.44269504088896338700 + TM_ROUND) - TM_ROUND;
+	double r = (x - k * TM_LN2_HI) - k * TM_LN2_LO;
+	double p = 1.0/6227020800.0;
+	p = p * r + 1.0/479001600.0;
+	p = p * r + 1.0/39916800.0;
+	p = p * r + 1.0/3628800.0;
+	p = p * r + 1.0/362880.0;
+	p = p * r + 1.0/40320.0;
+	p = p * r + 1.0/5040.0;
+	p = p * r + 1.0/720.0;
+	p = p * r + 1.0/120.0;
+	p = p * r + 1.0/24.0;
+	p = p * r + 1.0/6.0;
+	p = p * r + 0.5;
+	p = p * r + 1.0;
+	p = p * r + 1.0;
+	unsigned long long n = tm_bits(k + TM_ROUND) - tm_bits(TM_ROUND);
+	return p * tm_double((n + 1023) << 52);
+}
+
+/* log x for normal x > 0: x = 2^e m, m in [sqrt(1/2), sqrt(2)), and
+ * log m = 2 atanh(u), u = (m-1)/(m+1), |u| < 0.172, to u^21
+ */
+static inline __attribute__((always_inline)) double tm_log(double x)
+{
+	unsigned long long b = tm_bits(x);
+	double m = tm_double((b & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+	double de = tm_double((b >> 52) + tm_bits(TM_ROUND)) - (TM_ROUND + 1023.0);
+	double de1 = de + 1.0, mh = m * 0.5;
+	de = m > 1.41421356237309504880 ? de1 : de;
+	m = m > 1.41421356237309504880 ? mh : m;
+	double u = (m - 1.0) / (m + 1.0);
+	double u2 = u * u;
+	double p = 1.0/21.0;
+	p = p * u2 + 1.0/19.0;
+	p = p * u2 + 1.0/17.0;
+	p = p * u2 + 1.0/15.0;
+	p = p * u2 + 1.0/13.0;
+	p = p * u2 + 1.0/11.0;
+	p = p * u2 + 1.0/9.0;
+	p = p * u2 + 1.0/7.0;
+	p = p * u2 + 1.0/5.0;
+	p = p * u2 + 1.0/3.0;
+	return de * TM_LN2_HI + (de * TM_LN2_LO + 2.0 * u * u2 * p) + 2.0 * u;
+}
+
+/* sin and cos of x, |x| < 1e5: x = k pi/2 + r, |r| <= pi/4, Taylor to
+ * r^17 and r^16, and the quadrant k mod 4 picks the signs and which
+ */
+static inline __attribute__((always_inline)) void tm_sincos(double x, double *sx, double *cx)
+{
+	double k = (x * 0.63661977236758134308 + TM_ROUND) - TM_ROUND;
+	double r = ((x - k * TM_PIO2_1) - k * TM_PIO2_2) - k * TM_PIO2_3;
+	double r2 = r * r;
+	double s = -1.0/355687428096000.0;
+	s = s * r2 + 1.0/1307674368000.0;
+	s = s * r2 - 1.0/6227020800.0;
+	s = s * r2 + 1.0/39916800.0;
+	s = s * r2 - 1.0/362880.0;
+	s = s * r2 + 1.0/5040.0;
+	s = s * r2 - 1.0/120.0;
+	s = s * r2 + 1.0/6.0;
+	s = r - r * r2 * s;
+	double c = 1.0/20922789888000.0;
+	c = c * r2 - 1.0/87178291200.0;
+	c = c * r2 + 1.0/479001600.0;
+	c = c * r2 - 1.0/3628800.0;
+	c = c * r2 + 1.0/40320.0;
+	c = c * r2 - 1.0/720.0;
+	c = c * r2 + 1.0/24.0;
+	c = c * r2 - 0.5;
+	c = 1.0 + r2 * c;
+	// k mod 4, as floor(k/4) = round((k - 1.5)/4) for integer k
+	double q = k - 4.0 * (((k - 1.5) * 0.25 + TM_ROUND) - TM_ROUND);
+	int odd = (q == 1.0) | (q == 3.0);
+	double s1 = odd ? c : s;
+	double c1 = odd ? s : c;
+	*sx = q >= 2.0 ? -s1 : s1;
+	*cx = (q == 1.0) | (q == 2.0) ? -c1 : c1;
+}
+
+/* atan x: to [0, 1] by atan x = pi/2 - atan 1/x, to |z| <= tan(pi/8) by
+ * atan y = pi/4 + atan((y-1)/(y+1)), then halved once by
+ * atan z = 2 atan(z / (1 + sqrt(1 + z^2))), and Taylor to z^25
+ */
+static inline __attribute__((always_inline)) double tm_atan(double x)
+{
+	double ax = fabs(x), iax = 1.0 / ax;
+	double y = ax > 1.0 ? iax : ax;
+	double zb = (y - 1.0) / (y + 1.0);
+	double z = y > 0.41421356237309504880 ? zb : y;
+	z = z / (1.0 + sqrt(1.0 + z * z));
+	double z2 = z * z;
+	double p = 1.0/25.0;
+	p = -p * z2 + 1.0/23.0;
+	p = -p * z2 + 1.0/21.0;
+	p = -p * z2 + 1.0/19.0;
+	p = -p * z2 + 1.0/17.0;
+	p = -p * z2 + 1.0/15.0;
+	p = -p * z2 + 1.0/13.0;
+	p = -p * z2 + 1.0/11.0;
+	p = -p * z2 + 1.0/9.0;
+	p = -p * z2 + 1.0/7.0;
+	p = -p * z2 + 1.0/5.0;
+	p = -p * z2 + 1.0/3.0;
+	double a = 2.0 * (z - z * z2 * p);
+	double ab = TM_PI/4 + a;
+	a = y > 0.41421356237309504880 ? ab : a;
+	double ai = TM_PI/2 - a;
+	a = ax > 1.0 ? ai : a;
+	return x < 0 ? -a : a;
+}
+
+static inline __attribute__((always_inline)) double tm_atan2(double y, double x)
+{
+	double a = tm_atan(y / x);
+	double am = a - TM_PI, ap = a + TM_PI;
+	a = x == 0 ? (y < 0 ? -TM_PI/2 : TM_PI/2) : a;
+	return x < 0 ? (y < 0 ? am : ap) : a;
+}
+
+static inline __attribute__((always_inline)) double tm_atanh(double x)
+{
+	return 0.5 * tm_log((1.0 + x) / (1.0 - x));
+}
+
+// sum of c[j] sin(2j(xi + i eta)), j = 1..TM_ORDER, by the recurrence of sin(j t)
+static inline __attribute__((always_inline)) void tm_series(const double *c, double xi, double eta, double *dxi, double *deta)
+{
+	double s2, c2, e = tm_exp(2.0 * eta), ie = 1.0 / e;
+	double sh = 0.5 * (e - ie), ch = 0.5 * (e + ie);
+	tm_sincos(2.0 * xi, &s2, &c2);
+	// cos and sin of t = 2(xi + i eta)
+	double cr = c2 * ch, ci = -s2 * sh;
+	double sr = s2 * ch, si = c2 * sh;
+	double pr = 0, pi = 0, tr, ti;
+	double ar = 0, ai = 0;
+	int j;
+#pragma GCC unroll 8
+	for(j=1; j<=TM_ORDER; j++){
+		ar += c[j] * sr;
+		ai += c[j] * si;
+		tr = 2.0 * (cr * sr - ci * si) - pr;
+		ti = 2.0 * (cr * si + ci * sr) - pi;
+		pr = sr;
+		pi = si;
+		sr = tr;
+		si = ti;
+	}
+	*dxi = ar;
+	*deta = ai;
+}
+
+/* sinh(e atanh(e sin(phi))), giving the tangent of the conformal
+ * latitude as tau' = tau sqrt(1 + sig^2) - sig sqrt(1 + tau^2)
+ */
+static inline __attribute__((always_inline)) double tm_sigma(const TMERC *tm, double s)
+{
+	double et = tm_exp(tm->e * tm_atanh(tm->e * s));
+	return 0.5 * (et - 1.0 / et);
+}
+
+static inline __attribute__((always_inline)) void tm_forward_loop(const TMERC *tm, const double *lat, const double *lon, double *x, double *y, long n)
+{
+	const double d2r = TM_PI / 180.0;
+	long i;
+
+	for(i=0; i<n; i++){
+		double sp, cp, sl, cl, dxi, deta;
+		tm_sincos(lat[i] * d2r, &sp, &cp);
+		tm_sincos((lon[i] - tm->lon0) * d2r, &sl, &cl);
+		// tau' cos(phi), so the pole needs no tangent
+		double sig = tm_sigma(tm, sp);
+		double tp = sp * sqrt(1.0 + sig * sig) - sig;
+		double xip = tm_atan2(tp, cp * cl);
+		double v = cp * sl / sqrt(tp * tp + cp * cp * cl * cl);
+		double etap = tm_log(fabs(v) + sqrt(v * v + 1.0));
+		etap = v < 0 ? -etap : etap;
+		tm_series(tm->alp, xip, etap, &dxi, &deta);
+		x[i] = tm->fe + tm->ka * (etap + deta);
+		y[i] = tm->fn + tm->ka * (xip + dxi);
+	}
+}
+
+static inline __attribute__((always_inline)) void tm_inverse_loop(const TMERC *tm, const double *x, const double *y, double *lat, double *lon, long n)
+{
+	const double r2d = 180.0 / TM_PI;
+	long i;
+	int k;
+
+	for(i=0; i<n; i++){
+		double dxi, deta, sxi, cxi;
+		double xi = (y[i] - tm->fn) / tm->ka;
+		double eta = (x[i] - tm->fe) / tm->ka;
+		tm_series(tm->bet, xi, eta, &dxi, &deta);
+		xi -= dxi;
+		eta -= deta;
+		tm_sincos(xi, &sxi, &cxi);
+		double ee = tm_exp(eta);
+		double sh = 0.5 * (ee - 1.0 / ee);
+		double taup = sxi / sqrt(sh * sh + cxi * cxi);
+		// tau from tau' by Newton's method
+		double tau = taup / tm->e2m;
+#pragma GCC unroll 8
+		for(k=0; k<TM_NEWTON; k++){
+			double t1 = sqrt(1.0 + tau * tau);
+			double sig = tm_sigma(tm, tau / t1);
+			double tpi = tau * sqrt(1.0 + sig * sig) - sig * t1;
+			tau += (taup - tpi) / sqrt(1.0 + tpi * tpi) * (1.0 + tm->e2m * tau * tau) / (tm->e2m * t1);
+		}
+		lat[i] = tm_atan(tau) * r2d;
+		lon[i] = tm->lon0 + tm_atan2(sh, cxi) * r2d;
+	}
+}
+
+static void fwd_generic(const TMERC *tm, const double *lat, const double *lon, double *x, double *y, long n)
+{
+	tm_forward_loop(tm, lat, lon, x, y, n);
+}
+
+static void inv_generic(const TMERC *tm, const double *x, const double *y, double *lat, double *lon, long n)
+{
+	tm_inverse_loop(tm, x, y, lat, lon, n);
+}
+
+#ifdef TM_X86
+#define TM_VARIANTS(isa, tgt) \
+static __attribute__((target(tgt))) void fwd_##isa(const TMERC *tm, const double *lat, const double *lon, double *x, double *y, long n) \
+{ \
+	tm_forward_loop(tm, lat, lon, x, y, n); \
+} \
+static __attribute__((target(tgt))) void inv_##isa(const TMERC *tm, const double *x, const double *y, double *lat, double *lon, long n) \
+{ \
+	tm_inverse_loop(tm, x, y, lat, lon, n); \
+}
+
+TM_VARIANTS(avx2, "avx2")
+TM_VARIANTS(avx512, "avx512f")
+#endif
+
+/* Series coefficients of the ellipsoid of semi-major axis a and
+ * flattening f, after Karney (2011), eqs. 14, 35 and 36.
+ */
+void tm_init(TMERC *tm, double a, double f, double k0, double lon0, double fe, double fn)
+{
+	double n = f / (2 - f);
+	double n2 = n*n, n3 = n2*n, n4 = n3*n, n5 = n4*n, n6 = n5*n;
+
+	memset(tm, 0, sizeof(TMERC));
+	tm->lon0 = lon0;
+	tm->k0 = k0;
+	tm->fe = fe;
+	tm->fn = fn;
+	tm->e2m = (1 - f) * (1 - f);
+	tm->e = sqrt(f * (2 - f));
+	tm->ka = k0 * a / (1 + n) * (1 + n2/4 + n4/64 + n6/256);
+
+	tm->alp[1] = n/2 - 2*n2/3 + 5*n3/16 + 41*n4/180 - 127*n5/288 + 7891*n6/37800;
+	tm->alp[2] = 13*n2/48 - 3*n3/5 + 557*n4/1440 + 281*n5/630 - 1983433*n6/1935360;
+	tm->alp[3] = 61*n3/240 - 103*n4/140 + 15061*n5/26880 + 167603*n6/181440;
+	tm->alp[4] = 49561*n4/161280 - 179*n5/168 + 6601661*n6/7257600;
+	tm->alp[5] = 34729*n5/80640 - 3418889*n6/1995840;
+	tm->alp[6] = 212378941*n6/319334400;
+
+	tm->bet[1] = n/2 - 2*n2/3 + 37*n3/96 - n4/360 - 81*n5/512 + 96199*n6/604800;
+	tm->bet[2] = n2/48 + n3/15 - 437*n4/1440 + 46*n5/105 - 1118711*n6/3870720;
+	tm->bet[3] = 17*n3/480 - 37*n4/840 - 209*n5/4480 + 5569*n6/90720;
+	tm->bet[4] = 4397*n4/161280 - 11*n5/504 - 830251*n6/7257600;
+	tm->bet[5] = 4583*n5/161280 - 108847*n6/3991680;
+	tm->bet[6] = 20648693*n6/638668800;
+}
+
+// WGS-84 UTM zone 1..60, negative in the south
+void tm_utm(TMERC *tm, long zone)
+{
+	long z = zone < 0 ? -zone : zone;
+	tm_init(tm, 6378137.0, 1/298.257223563, 0.9996, (z - 1) * 6 - 180 + 3, 500000.0, zone < 0 ? 10000000.0 : 0.0);
+}
+
+/* Map coordinates x, y of n points of latitude and longitude in degrees,
+ * on the instruction set of the statistics kernels.
+ */
+void tm_forward(const TMERC *tm, const double *lat, const double *lon, double *x, double *y, long n)
+{
+#ifdef TM_X86
+	char *k = kernel_name();
+	if(strcmp(k, "avx512") == 0){
+		fwd_avx512(tm, lat, lon, x, y, n);
+		return;
+	}
+	if(strcmp(k, "avx2") == 0){
+		fwd_avx2(tm, lat, lon, x, y, n);
+		return;
+	}
+#endif
+	fwd_generic(tm, lat, lon, x, y, n);
+}
+
+// latitude and longitude in degrees of n points x, y
+void tm_inverse(const TMERC *tm, const double *x, const double *y, double *lat, double *lon, long n)
+{
+#ifdef TM_X86
+	char *k = kernel_name();
+	if(strcmp(k, "avx512") == 0){
+		inv_avx512(tm, x, y, lat, lon, n);
+		return;
+	}
+	if(strcmp(k, "avx2") == 0){
+		inv_avx2(tm, x, y, lat, lon, n);
+		return;
+	}
+#endif
+	inv_generic(tm, x, y, lat, lon, n);
+}
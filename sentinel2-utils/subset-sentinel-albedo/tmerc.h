@@ -0,0 +1,29 @@
+#ifndef __INC_TMERC_H
+#define __INC_TMERC_H
+
+// order of the Kruger series
+#define TM_ORDER (6)
+
+/* Transverse Mercator on an ellipsoid by the Kruger series in the third
+ * flattening to sixth order, accurate to well under a millimetre across a
+ * UTM zone and beyond. alp and bet are the forward and inverse series
+ * coefficients, [1..TM_ORDER]; ka is k0 times the rectifying radius.
+ */
+typedef struct{
+	double lon0;		// central meridian, degrees
+	double k0;
+	double fe;
+	double fn;
+	double e;		// eccentricity
+	double e2m;		// 1 - e^2
+	double ka;
+	double alp[TM_ORDER+1];
+	double bet[TM_ORDER+1];
+}TMERC;
+
+void tm_init(TMERC *tm, double a, double f, double k0, double lon0, double fe, double fn);
+void tm_utm(TMERC *tm, long zone);
+void tm_forward(const TMERC *tm, const double *lat, const double *lon, double *x, double *y, long n);
+void tm_inverse(const TMERC *tm, const double *x, const double *y, double *lat, double *lon, long n);
+
+#endif
@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "warp.h"
+#include "tmerc.h"
+#include "footprint.h"
+
+// cell of the target grid and the source pixel under its centre
+typedef struct{
+	int row;
+	int col;
+	int ring;
+}WARP_CELL;
+
+static unsigned long warp_hash(const SPACE *sp, double lat, double lon, double cell, int shape, const int *size, int nfp)
+{
+	double key[7];
+	const SPACE_PROJ *proj = sp->proj;
+	unsigned char *p = (unsigned char *)key;
+	unsigned long h = 2166136261UL ^ (unsigned long)(shape*WARP_MAX_FP + nfp);
+	size_t i;
+	int k;
+
+	key[0] = sp->ul_x;
+	key[1] = sp->ul_y;
+	key[2] = sp->pix_size;
+	key[3] = sp->pix_y;
+	key[4] = lat;
+	key[5] = lon;
+	key[6] = cell;
+	for(i=0; i<sizeof(key); i++){
+		h = (h ^ p[i]) * 16777619UL;
+	}
+	p = (unsigned char *)&proj;
+	for(i=0; i<sizeof(proj); i++){
+		h = (h ^ p[i]) * 16777619UL;
+	}
+	for(k=0; k<nfp; k++){
+		h = (h ^ (unsigned long)size[k]) * 16777619UL;
+	}
+	return h;
+}
+
+static int warp_match(const WARP_LUT *lut, const SPACE *sp, double lat, double lon, double cell, int shape, const int *size, int nfp)
+{
+	return lut->grid.proj == sp->proj && lut->grid.ul_x == sp->ul_x && lut->grid.ul_y == sp->ul_y
+		&& lut->grid.pix_size == sp->pix_size && lut->grid.pix_y == sp->pix_y
+		&& lut->lat == lat && lut->lon == lon && lut->cell == cell && lut->shape == shape
+		&& lut->nfp == nfp && memcmp(lut->size, size, nfp*sizeof(int)) == 0;
+}
+
+static int cmp_cell(const void *a, const void *b)
+{
+	const WARP_CELL *x = (const WARP_CELL *)a, *y = (const WARP_CELL *)b;
+
+	if(x->row != y->row){
+		return x->row < y->row ? -1 : 1;
+	}
+	return x->col < y->col ? -1 : x->col > y->col;
+}
+
+// smallest footprint holding the cell centre (x, y) metres from the site, nfp if none
+static int warp_ring(double x, double y, int shape, const int *size, int nfp)
+{
+	int k;
+
+	for(k=0; k<nfp; k++){
+		double r = size[k] / 2.0;
+		if(shape == FP_CIRCLE ? x*x + y*y <= r*r : fabs(x) <= r && fabs(y) <= r){
+			break;
+		}
+	}
+	return k;
+}
+
+/* Target cells of the largest footprint, through the local transverse
+ * Mercator to lat/lon and the source grid to its pixels, sorted by
+ * source row.
+ */
+static WARP_LUT *warp_build(const SPACE *sp, double lat, double lon, double cell, int shape, const int *size, int nfp)
+{
+	int h = (int)floor(size[nfp-1] / 2.0 / cell);
+	int side = 2*h + 1;
+	long ngrid = (long)side*side;
+	WARP_LUT *lut = (WARP_LUT *)calloc(1, sizeof(WARP_LUT));
+	WARP_CELL *wc = (WARP_CELL *)malloc(ngrid*sizeof(WARP_CELL));
+	double *v = (double *)malloc(4*ngrid*sizeof(double));
+	double *x = v, *y = v + ngrid, *l = v + 2*ngrid, *s = v + 3*ngrid;
+	double x0, y0;
+	int next[WARP_MAX_FP];
+	TMERC tm;
+	long i, n = 0;
+	int j, k;
+
+	if(lut == NULL || wc == NULL || v == NULL){
+		goto fail;
+	}
+	lut->grid = *sp;
+	lut->lat = lat;
+	lut->lon = lon;
+	lut->cell = cell;
+	lut->shape = shape;
+	lut->nfp = nfp;
+	memcpy(lut->size, size, nfp*sizeof(int));
+
+	// cell centres inside the largest footprint, the centre cell on the site
+	for(i=0; i<side; i++){
+		for(j=0; j<side; j++){
+			double cx = (j - h) * cell, cy = (h - i) * cell;
+			k = warp_ring(cx, cy, shape, size, nfp);
+			if(k < nfp){
+				x[n] = cx;
+				y[n] = cy;
+				wc[n++].ring = k;
+			}
+		}
+	}
+
+	tm_init(&tm, 6378137.0, 1/298.257223563, 1.0, lon, 0, 0);
+	tm_forward(&tm, &lat, &lon, &x0, &y0, 1);
+	tm.fn = -y0;
+	tm_inverse(&tm, x, y, l, s, n);
+	// l, s hold lat, lon until the source grid takes them to lines and samples
+	if(0 != space_to_n(sp, l, s, x, y, n)){
+		lut->r1 = -1;
+	}
+
+	lut->n = n;
+	lut->row = (int *)malloc(3*n*sizeof(int));
+	if(lut->row == NULL){
+		goto fail;
+	}
+	lut->col = lut->row + n;
+	lut->slot = lut->col + n;
+	for(i=0; i<n; i++){
+		// the rows and columns of unprojected cells are never read
+		wc[i].row = x[i] == x[i] ? (int)floor(x[i]) : 0;
+		wc[i].col = y[i] == y[i] ? (int)floor(y[i]) : 0;
+	}
+	qsort(wc, n, sizeof(WARP_CELL), cmp_cell);
+
+	for(i=0; i<n; i++){
+		lut->rs[wc[i].ring+1]++;
+	}
+	for(k=0; k<nfp; k++){
+		lut->rs[k+1] += lut->rs[k];
+	}
+	memcpy(next, lut->rs, nfp*sizeof(int));
+	for(i=0; i<n; i++){
+		lut->row[i] = wc[i].row;
+		lut->col[i] = wc[i].col;
+		lut->slot[i] = next[wc[i].ring]++;
+	}
+	if(lut->r1 == 0){
+		lut->r1 = wc[0].row;
+		lut->r2 = wc[n-1].row;
+		lut->c1 = lut->c2 = wc[0].col;
+		for(i=1; i<n; i++){
+			lut->c1 = wc[i].col < lut->c1 ? wc[i].col : lut->c1;
+			lut->c2 = wc[i].col > lut->c2 ? wc[i].col : lut->c2;
+		}
+	}
+	free(wc);
+	free(v);
+	return lut;
+
+fail:
+	free(lut);
+	free(wc);
+	free(v);
+	return NULL;
+}
+
+/* Lookup table of a site's target grid over a source grid, built on
+ * first use. Every image of a tile shares its grid, so the images of a
+ * site after the first of each tile and zone get the table back.
+ */
+const WARP_LUT *warp_get(WARP_CACHE *cache, const SPACE *sp, double lat, double lon, double cell, int shape, const int *size, int nfp)
+{
+	WARP_LUT *lut;
+	unsigned long h;
+	int i;
+
+	if(nfp < 1 || nfp > WARP_MAX_FP){
+		return NULL;
+	}
+	if(cache->n >= cache->nslot){
+		// grow and rehash
+		int nslot = cache->nslot > 0 ? cache->nslot*2 : 64;
+		WARP_LUT **slot = (WARP_LUT **)calloc(nslot, sizeof(WARP_LUT *));
+		if(slot == NULL){
+			return NULL;
+		}
+		for(i=0; i<cache->nslot; i++){
+			while((lut = cache->slot[i]) != NULL){
+				cache->slot[i] = lut->next;
+				h = warp_hash(&lut->grid, lut->lat, lut->lon, lut->cell, lut->shape, lut->size, lut->nfp) % nslot;
+				lut->next = slot[h];
+				slot[h] = lut;
+			}
+		}
+		free(cache->slot);
+		cache->slot = slot;
+		cache->nslot = nslot;
+	}
+
+	h = warp_hash(sp, lat, lon, cell, shape, size, nfp) % cache->nslot;
+	for(lut=cache->slot[h]; lut!=NULL; lut=lut->next){
+		if(warp_match(lut, sp, lat, lon, cell, shape, size, nfp)){
+			return lut;
+		}
+	}
+
+	lut = warp_build(sp, lat, lon, cell, shape, size, nfp);
+	if(lut == NULL){
+		return NULL;
+	}
+	lut->next = cache->slot[h];
+	cache->slot[h] = lut;
+	cache->n++;
+	return lut;
+}
+
+void warp_free_cache(WARP_CACHE *cache)
+{
+	WARP_LUT *lut;
+	int i;
+
+	for(i=0; i<cache->nslot; i++){
+		while((lut = cache->slot[i]) != NULL){
+			cache->slot[i] = lut->next;
+			free(lut->row);
+			free(lut);
+		}
+	}
+	free(cache->slot);
+	cache->slot = NULL;
+	cache->nslot = 0;
+	cache->n = 0;
+}
+
+/* Moments of each footprint ring of lut over the image into m, nband per
+ * ring. The source rows are read one at a time and the values of their
+ * cells gathered by slot into one BIP buffer, for one kernel call per
+ * ring.
+ */
+int warp_stats(const WARP_LUT *lut, RASTER *ras, const ENVI_HDR *envi, PIX_FN kbip, const NODATA *nd, MOMENT *m)
+{
+	const int nb = envi->nband, ds = ras->dsize;
+	char *g = (char *)malloc((long)lut->n*nb*ds);
+	char *row = (char *)malloc((long)envi->ncol*nb*ds);
+	RSPAN *span = (RSPAN *)malloc(nb*sizeof(RSPAN));
+	long bstride;
+	int i = 0, r, b, k, nspan, ret = -1;
+
+	if(g == NULL || row == NULL || span == NULL){
+		goto done;
+	}
+	while(i < lut->n){
+		r = lut->row[i];
+		nspan = raster_row_spans(ras, r, lut->c1, lut->c2, row, span);
+		if(ras->direct){
+			raster_advise(ras, span, nspan);
+		}
+		else if(0 != raster_readv(ras, span, nspan)){
+			fprintf(stderr, "READ FAILED. row %d\n", r);
+			goto done;
+		}
+		const char *p = raster_row(ras, r, row, &bstride);
+		for(; i<lut->n && lut->row[i]==r; i++){
+			char *d = g + (long)lut->slot[i]*nb*ds;
+			const long c = lut->col[i];
+			if(envi->il == ENVI_BIP){
+				memcpy(d, p + c*nb*ds, (size_t)nb*ds);
+			}
+			else{
+				for(b=0; b<nb; b++){
+					memcpy(d + b*ds, p + (b*bstride + c)*ds, ds);
+				}
+			}
+		}
+	}
+	for(k=0; k<lut->nfp; k++){
+		kbip(g + (long)lut->rs[k]*nb*ds, lut->rs[k+1] - lut->rs[k], nb, 0, nd, m + (long)k*nb);
+	}
+	ret = 0;
+
+done:
+	free(g);
+	free(row);
+	free(span);
+	return ret;
+}
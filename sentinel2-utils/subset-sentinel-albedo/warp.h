@@ -0,0 +1,58 @@
+#ifndef __INC_WARP_H
+#define __INC_WARP_H
+
+#include "envi.h"
+#include "space.h"
+#include "raster.h"
+#include "kernel.h"
+
+// footprint sizes of one target grid
+#define WARP_MAX_FP (16)
+
+/* Footprints of a site resampled onto its own grid: square cells of cell
+ * metres on a transverse Mercator centred at the site (central meridian
+ * through it, scale 1, origin at it), which keeps distances from the
+ * site to well under a millimetre over any footprint, whatever zone or
+ * grid the image is in. Each cell inside the largest footprint takes the
+ * source pixel under its centre, nearest neighbour, so every image of
+ * every zone is sampled over the same ground cells.
+ * The cells are kept in source row order, with row, col the source pixel
+ * and slot the cell's place in a buffer grouped by footprint ring: ring k
+ * is slots rs[k]..rs[k+1]-1, the cells of footprint k not in a smaller
+ * one. r1..c2 bound the source pixels; r1 is -1 when a cell could not be
+ * projected.
+ */
+typedef struct WARP_LUT{
+	SPACE grid;		// source grid
+	// target grid
+	double lat;
+	double lon;
+	double cell;
+	int shape;
+	int nfp;
+	int size[WARP_MAX_FP];
+
+	int n;
+	int *row;
+	int *col;
+	int *slot;
+	int rs[WARP_MAX_FP+1];
+	int r1;
+	int r2;
+	int c1;
+	int c2;
+	struct WARP_LUT *next;
+}WARP_LUT;
+
+// lookup tables built so far, hashed by source and target grid
+typedef struct{
+	WARP_LUT **slot;
+	int nslot;
+	int n;
+}WARP_CACHE;
+
+const WARP_LUT *warp_get(WARP_CACHE *cache, const SPACE *sp, double lat, double lon, double cell, int shape, const int *size, int nfp);
+void warp_free_cache(WARP_CACHE *cache);
+int warp_stats(const WARP_LUT *lut, RASTER *ras, const ENVI_HDR *envi, PIX_FN kbip, const NODATA *nd, MOMENT *m);
+
+#endif
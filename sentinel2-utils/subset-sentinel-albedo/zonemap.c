@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "zonemap.h"
+
+/* Range of the valid values of npix pixels per band, widened into lo and
+ * hi. ps and bs are the pixel and band strides in values; NaN is never
+ * valid, as in the kernels.
+ */
+#define ZM_RANGE(name, T) \
+static void name(const char *row, long npix, int nband, long ps, long bs, const NODATA *nd, double *lo, double *hi) \
+{ \
+	const T *p = (const T *)row; \
+	int use = nd->set; \
+	T ndv = use ? (T)nd->value : 0; \
+	long i; \
+	int b; \
+	for(b=0; b<nband; b++){ \
+		for(i=0; i<npix; i++){ \
+			T v = p[i*ps + b*bs]; \
+			if(v != v || (use && v == ndv)){ \
+				continue; \
+			} \
+			if(v < lo[b]){ \
+				lo[b] = v; \
+			} \
+			if(v > hi[b]){ \
+				hi[b] = v; \
+			} \
+		} \
+	} \
+}
+
+ZM_RANGE(range_uint8, unsigned char)
+ZM_RANGE(range_int16, short)
+ZM_RANGE(range_uint16, unsigned short)
+ZM_RANGE(range_int32, int)
+ZM_RANGE(range_uint32, unsigned int)
+ZM_RANGE(range_int64, long long)
+ZM_RANGE(range_uint64, unsigned long long)
+ZM_RANGE(range_float32, float)
+ZM_RANGE(range_float64, double)
+
+typedef void (*ZM_RANGE_FN)(const char *row, long npix, int nband, long ps, long bs, const NODATA *nd, double *lo, double *hi);
+
+static ZM_RANGE_FN zm_range(int dtype)
+{
+	switch(dtype){
+	case 1:
+		return range_uint8;
+	case 2:
+		return range_int16;
+	case 3:
+		return range_int32;
+	case 4:
+		return range_float32;
+	case 5:
+		return range_float64;
+	case 12:
+		return range_uint16;
+	case 13:
+		return range_uint32;
+	case 14:
+		return range_int64;
+	case 15:
+		return range_uint64;
+	}
+	return NULL;
+}
+
+static void zm_header(ZM_HDR *h, ENVI_HDR *envi, const NODATA *nd, struct stat *st)
+{
+	memset(h, 0, sizeof(ZM_HDR));
+	memcpy(h->magic, ZM_MAGIC, sizeof(h->magic));
+	h->nrow = envi->nrow;
+	h->ncol = envi->ncol;
+	h->nband = envi->nband;
+	h->dtype = envi->dtype;
+	h->byteorder = envi->byteorder;
+	h->ndset = nd->set;
+	h->ndvalue = nd->set ? nd->value : 0;
+	h->hoffset = envi->hoffset;
+	h->src_size = st->st_size;
+	h->src_mtime = st->st_mtim.tv_sec;
+	h->src_mtime_ns = st->st_mtim.tv_nsec;
+	h->block = ZM_BLOCK;
+}
+
+/* Map the zone map of fenvi. With save it is mapped shared read-write,
+ * created, or cleared when it was built from another version of the
+ * image; returns -1 if it can not be had, e.g. in a read-only archive.
+ * The file is then held under an exclusive flock until zm_close, so two
+ * runs over the same image that both save take turns on it instead of
+ * interleaving their blocks and flags; the second waits in zm_open.
+ * Without save, the file is only read: a current one is copied into
+ * memory under a shared flock, a consistent snapshot even while another
+ * run saves, and anything else is replaced by an empty map, so blocks
+ * built in the run never reach the disk.
+ */
+int zm_open(ZMAP *zm, char *fenvi, ENVI_HDR *envi, const NODATA *nd, int save)
+{
+	char name[4096];
+	struct stat st;
+	ZM_HDR h;
+	long nflag;
+	long long got;
+	ssize_t k;
+	int fd;
+
+	memset(zm, 0, sizeof(ZMAP));
+	zm->fd = -1;
+	if(zm_range(envi->dtype) == NULL || stat(fenvi, &st) != 0){
+		return -1;
+	}
+	zm_header(&h, envi, nd, &st);
+
+	zm->nrow = envi->nrow;
+	zm->ncol = envi->ncol;
+	zm->nband = envi->nband;
+	zm->nby = (envi->nrow + ZM_BLOCK - 1) / ZM_BLOCK;
+	zm->nbx = (envi->ncol + ZM_BLOCK - 1) / ZM_BLOCK;
+	// flags padded so the stats stay 8-byte aligned
+	nflag = ((long)zm->nby*zm->nbx + 7) / 8 * 8;
+	zm->size = (long long)sizeof(ZM_HDR) + nflag + (long long)zm->nby*zm->nbx*zm->nband*sizeof(ZSTAT);
+
+	snprintf(name, sizeof(name), "%s%s", fenvi, ZM_SUFFIX);
+	fd = save ? open(name, O_RDWR | O_CREAT, 0644) : open(name, O_RDONLY);
+	if(fd >= 0 && (0 != flock(fd, save ? LOCK_EX : LOCK_SH) || fstat(fd, &st) != 0)){
+		close(fd);
+		return -1;
+	}
+	if(save){
+		if(fd < 0){
+			return -1;
+		}
+		if(st.st_size != zm->size && 0 != ftruncate(fd, (off_t)zm->size)){
+			close(fd);
+			return -1;
+		}
+		zm->map = (char *)mmap(NULL, (size_t)zm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(zm->map == (char *)MAP_FAILED){
+			close(fd);
+		}
+		else{
+			zm->fd = fd;
+		}
+	}
+	else{
+		zm->map = (char *)mmap(NULL, (size_t)zm->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(fd >= 0 && st.st_size == zm->size && zm->map != (char *)MAP_FAILED){
+			for(got=0; got<zm->size; got+=k){
+				k = pread(fd, zm->map + got, (size_t)(zm->size - got), (off_t)got);
+				if(k <= 0){
+					// a short copy is no zone map: the header check clears it
+					memset(zm->map, 0, sizeof(ZM_HDR));
+					break;
+				}
+			}
+		}
+		if(fd >= 0){
+			close(fd);
+		}
+	}
+	if(zm->map == (char *)MAP_FAILED){
+		zm->map = NULL;
+		return -1;
+	}
+
+	if(0 != memcmp(zm->map, &h, sizeof(ZM_HDR))){
+		// new or stale: no block is built
+		memset(zm->map + sizeof(ZM_HDR), 0, (size_t)nflag);
+		memcpy(zm->map, &h, sizeof(ZM_HDR));
+	}
+	zm->built = (unsigned char *)(zm->map + sizeof(ZM_HDR));
+	zm->stat = (ZSTAT *)(zm->map + sizeof(ZM_HDR) + nflag);
+	return 0;
+}
+
+void zm_close(ZMAP *zm)
+{
+	if(zm->map != NULL){
+		munmap(zm->map, (size_t)zm->size);
+	}
+	if(zm->fd >= 0){
+		// releases the flock
+		close(zm->fd);
+	}
+	zm->map = NULL;
+	zm->built = NULL;
+	zm->stat = NULL;
+	zm->fd = -1;
+}
+
+/* Read block (by, bx) row by row and record its statistics. The moments
+ * come from the data type's kernel kfn, as for a window.
+ */
+int zm_build_block(ZMAP *zm, RASTER *ras, int dtype, int by, int bx, PIX_FN kfn, const NODATA *nd)
+{
+	ZM_RANGE_FN range = zm_range(dtype);
+	ZSTAT *zs = zm->stat + ((long)by*zm->nbx + bx)*zm->nband;
+	int r0 = by*ZM_BLOCK, c0 = bx*ZM_BLOCK;
+	int r1 = r0 + ZM_BLOCK < zm->nrow ? r0 + ZM_BLOCK : zm->nrow;
+	int c1 = c0 + ZM_BLOCK < zm->ncol ? c0 + ZM_BLOCK : zm->ncol;
+	char *row = (char *)malloc((long)zm->ncol*zm->nband*ras->dsize);
+	RSPAN *span = (RSPAN *)malloc(zm->nband*sizeof(RSPAN));
+	MOMENT *m = (MOMENT *)malloc(zm->nband*sizeof(MOMENT));
+	double *lo = (double *)malloc(2*zm->nband*sizeof(double));
+	double *hi = lo + zm->nband;
+	long bstride;
+	int r, b, nspan;
+
+	if(row == NULL || span == NULL || m == NULL || lo == NULL){
+		free(row);
+		free(span);
+		free(m);
+		free(lo);
+		return -1;
+	}
+	for(b=0; b<zm->nband; b++){
+		moment_init(&m[b]);
+		lo[b] = 1e308;
+		hi[b] = -1e308;
+	}
+
+	for(r=r0; r<r1; r++){
+		nspan = raster_row_spans(ras, r, c0, c1-1, row, span);
+		if(!ras->direct && 0 != raster_readv(ras, span, nspan)){
+			fprintf(stderr, "READ FAILED. row %d\n", r);
+			free(row);
+			free(span);
+			free(m);
+			free(lo);
+			return -1;
+		}
+		char *p = raster_row(ras, r, row, &bstride);
+		if(ras->il == ENVI_BIP){
+			p += (long)c0*zm->nband*ras->dsize;
+			range(p, c1-c0, zm->nband, zm->nband, 1, nd, lo, hi);
+		}
+		else{
+			p += (long)c0*ras->dsize;
+			range(p, c1-c0, zm->nband, 1, bstride, nd, lo, hi);
+		}
+		kfn(p, c1-c0, zm->nband, bstride, nd, m);
+	}
+
+	for(b=0; b<zm->nband; b++){
+		zs[b].m = m[b];
+		zs[b].min = lo[b];
+		zs[b].max = hi[b];
+	}
+	zm->built[(long)by*zm->nbx + bx] = 1;
+	zm->nbuilt++;
+
+	free(row);
+	free(span);
+	free(m);
+	free(lo);
+	return 0;
+}
+
+// built block without a valid value in any band
+int zm_empty(const ZMAP *zm, int by, int bx)
+{
+	const ZSTAT *zs = zm_block(zm, by, bx);
+	int b;
+
+	if(zs == NULL){
+		return 0;
+	}
+	for(b=0; b<zm->nband; b++){
+		if(zs[b].m.n > 0){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// statistics of a built block, NULL if it is not built yet
+const ZSTAT *zm_block(const ZMAP *zm, int by, int bx)
+{
+	long i = (long)by*zm->nbx + bx;
+	return zm->built[i] ? zm->stat + i*zm->nband : NULL;
+}
@@ -0,0 +1,63 @@
+#ifndef __INC_ZONEMAP_H
+#define __INC_ZONEMAP_H
+
+#include "envi.h"
+#include "stats.h"
+#include "kernel.h"
+#include "raster.h"
+
+#define ZM_MAGIC "S2ZMAP01"
+#define ZM_SUFFIX ".zmi"
+#define ZM_BLOCK (256)
+
+// valid values of one band in one block
+typedef struct{
+	MOMENT m;		// count, mean and M2; the sum is n*mean
+	double min;
+	double max;
+}ZSTAT;
+
+/* Zone map <image>.zmi: per ZM_BLOCK x ZM_BLOCK block of the image, a
+ * built flag and one ZSTAT per band. Blocks are filled in as queries read
+ * them whole, so it grows with use. It is reset when the image size,
+ * mtime, layout or nodata no longer match the header. Only when asked is
+ * the file written; otherwise the blocks built live for the run only.
+ */
+typedef struct{
+	char magic[8];
+	int nrow;
+	int ncol;
+	int nband;
+	int dtype;
+	int byteorder;
+	int ndset;
+	double ndvalue;
+	long long hoffset;
+	long long src_size;
+	long long src_mtime;
+	long long src_mtime_ns;
+	int block;
+	int pad;
+}ZM_HDR;
+
+typedef struct{
+	char *map;
+	long long size;
+	int nrow;
+	int ncol;
+	int nband;
+	int nby;
+	int nbx;
+	unsigned char *built;	// nby*nbx flags
+	ZSTAT *stat;		// nby*nbx*nband
+	int nbuilt;		// blocks built by this process
+	int fd;			// sidecar held locked while saving, else -1
+}ZMAP;
+
+int zm_open(ZMAP *zm, char *fenvi, ENVI_HDR *envi, const NODATA *nd, int save);
+void zm_close(ZMAP *zm);
+int zm_build_block(ZMAP *zm, RASTER *ras, int dtype, int by, int bx, PIX_FN kfn, const NODATA *nd);
+int zm_empty(const ZMAP *zm, int by, int bx);
+const ZSTAT *zm_block(const ZMAP *zm, int by, int bx);
+
+#endif